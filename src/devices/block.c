@@ -3,7 +3,12 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/cpu.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Most sectors the I/O thread merges into one transfer. */
+#define MERGE_MAX_SECTORS 64
 
 /* A block device. */
 struct block
@@ -17,8 +22,14 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    /* Request queue, served by the device's I/O thread.  Devices
+       with a map operation have neither. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_ready;       /* Signaled when queue gets work. */
+    struct list queue;                  /* Pending block_requests. */
+    block_sector_t head;                /* Sector after the last transfer. */
+
+    struct block_stats stats;           /* Statistics. */
   };
 
 /* List of all block devices. */
@@ -28,6 +39,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func io_thread NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +125,18 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR lie within
+   BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +144,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +155,320 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes.  Drivers that support it move
+   all of them with as few commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_request req;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&req, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Initializes REQ to transfer the CNT sectors starting at SECTOR
+   between a block device and BUFFER, writing to the device if
+   WRITE is true and reading from it otherwise.
+   If DONE is non-null, the device's I/O thread calls it with REQ
+   and AUX once the transfer is complete, and REQ may not be passed
+   to block_wait().  DONE must not sleep for long, because the
+   device serves no other request meanwhile. */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_done_func *done, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->done = done;
+  req->aux = aux;
+  sema_init (&req->finished, 0);
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.
+   Panics if REQ extends past the end of BLOCK. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  for (;;)
+    {
+      check_sectors (block, req->sector, req->cnt);
+      ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+      lock_acquire (&block->queue_lock);
+      if (req->write)
+        block->stats.write_cnt += req->cnt;
+      else
+        block->stats.read_cnt += req->cnt;
+      lock_release (&block->queue_lock);
+
+      if (block->ops->map == NULL)
+        break;
+      block = block->ops->map (block->aux, &req->sector);
+    }
+
+  lock_acquire (&block->queue_lock);
+  req->submitted = rdtsc ();
+  if (++block->stats.in_flight > block->stats.max_in_flight)
+    block->stats.max_in_flight = block->stats.in_flight;
+  list_push_back (&block->queue, &req->elem);
+  cond_signal (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for REQ, which must have been submitted without a
+   completion function, to finish. */
+void
+block_wait (struct block_request *req)
+{
+  ASSERT (req->done == NULL);
+  sema_down (&req->finished);
+}
+
+/* Returns the queued request that BLOCK should serve next, in
+   C-LOOK order: the one with the lowest sector at or after the
+   end of the previous transfer, or, if there is none, the one
+   with the lowest sector overall.  BLOCK's queue must not be
+   empty and its queue_lock must be held. */
+static struct block_request *
+elevator_next (struct block *block)
+{
+  struct block_request *next = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= block->head
+          && (next == NULL || r->sector < next->sector))
+        next = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+    }
+  return next != NULL ? next : lowest;
+}
+
+/* Removes from BLOCK's queue and returns a request that starts
+   at SECTOR, transfers at most MAX_CNT sectors, and goes in the
+   same direction as WRITE, or returns a null pointer if there is
+   no such request.  BLOCK's queue_lock must be held. */
+static struct block_request *
+take_adjacent (struct block *block, bool write, block_sector_t sector,
+               size_t max_cnt)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->write == write && r->sector == sector && r->cnt <= max_cnt)
+        {
+          list_remove (e);
+          return r;
+        }
+    }
+  return NULL;
+}
+
+/* Has BLOCK's driver transfer CNT sectors starting at SECTOR
+   to or from BUFFER. */
+static void
+do_transfer (struct block *block, bool write, block_sector_t sector,
+             size_t cnt, void *buffer)
+{
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i,
+                             p + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i,
+                            p + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Transfers every request in BATCH, which hold consecutive
+   sectors in order and all go in the same direction, with one
+   driver call if memory allows. */
+static void
+do_batch (struct block *block, struct list *batch)
+{
+  struct block_request *first
+    = list_entry (list_front (batch), struct block_request, elem);
+  size_t cnt = 0;
+  uint8_t *buffer;
+  struct list_elem *e;
+
+  if (list_size (batch) == 1)
+    {
+      do_transfer (block, first->write, first->sector, first->cnt,
+                   first->buffer);
+      return;
+    }
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    cnt += list_entry (e, struct block_request, elem)->cnt;
+
+  buffer = malloc (cnt * BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    {
+      /* Transfer the requests one by one instead. */
+      for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request,
+                                                elem);
+          do_transfer (block, r->write, r->sector, r->cnt, r->buffer);
+        }
+      return;
+    }
+
+  if (first->write)
+    for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        memcpy (buffer + (r->sector - first->sector) * BLOCK_SECTOR_SIZE,
+                r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+      }
+  do_transfer (block, first->write, first->sector, cnt, buffer);
+  if (!first->write)
+    for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        memcpy (r->buffer,
+                buffer + (r->sector - first->sector) * BLOCK_SECTOR_SIZE,
+                r->cnt * BLOCK_SECTOR_SIZE);
+      }
+  free (buffer);
+}
+
+/* Records in BLOCK's statistics that request R has finished.
+   BLOCK's queue_lock must be held. */
+static void
+record_latency (struct block *block, struct block_request *r)
+{
+  uint64_t cycles = rdtsc () - r->submitted;
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < BLOCK_HIST_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  if (r->write)
+    block->stats.write_hist[bucket]++;
+  else
+    block->stats.read_hist[bucket]++;
+  block->stats.in_flight--;
+}
+
+/* Serves the request queue of the block device passed as
+   BLOCK_.  Picks requests in elevator order, merges each with
+   queued requests for the sectors right after it, and transfers
+   them with the queue unlocked. */
+static void
+io_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *r;
+      struct list batch;
+      struct list_elem *e;
+      block_sector_t end;
+      size_t cnt;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_ready, &block->queue_lock);
+
+      r = elevator_next (block);
+      list_remove (&r->elem);
+      list_init (&batch);
+      list_push_back (&batch, &r->elem);
+      end = r->sector + r->cnt;
+      cnt = r->cnt;
+      while (cnt < MERGE_MAX_SECTORS)
+        {
+          struct block_request *next
+            = take_adjacent (block, r->write, end, MERGE_MAX_SECTORS - cnt);
+          if (next == NULL)
+            break;
+          list_push_back (&batch, &next->elem);
+          end += next->cnt;
+          cnt += next->cnt;
+        }
+      block->head = end;
+      lock_release (&block->queue_lock);
+
+      do_batch (block, &batch);
+
+      /* Account for the finished requests before completing them,
+         because completion may free them. */
+      lock_acquire (&block->queue_lock);
+      for (e = list_begin (&batch); e != list_end (&batch); e = list_next (e))
+        {
+          r = list_entry (e, struct block_request, elem);
+          record_latency (block, r);
+        }
+      lock_release (&block->queue_lock);
+
+      while (!list_empty (&batch))
+        {
+          r = list_entry (list_pop_front (&batch), struct block_request, elem);
+          if (r->done != NULL)
+            r->done (r, r->aux);
+          else
+            sema_up (&r->finished);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +492,47 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Copies the statistics of the block device named NAME into
+   *STATS.  Returns false if there is no such device. */
+bool
+block_get_stats (const char *name, struct block_stats *stats)
+{
+  struct block *block = block_get_by_name (name);
+  if (block == NULL)
+    return false;
+
+  lock_acquire (&block->queue_lock);
+  *stats = block->stats;
+  lock_release (&block->queue_lock);
+  return true;
+}
+
+/* Prints the nonempty buckets of latency histogram HIST, for
+   requests of the kind WHAT to block device BLOCK, on one line. */
+static void
+print_histogram (struct block *block, const char *what, const uint32_t *hist)
+{
+  bool any = false;
+  int i;
+
+  for (i = 0; i < BLOCK_HIST_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        if (!any)
+          printf ("%s: %s latency (log2 cycles: count):", block->name, what);
+        printf (" %d:%"PRIu32, i, hist[i]);
+        any = true;
+      }
+  if (any)
+    printf ("\n");
+}
+
+/* Prints statistics for each block device used for a Pintos role,
+   then latency and driver figures for each device that did I/O. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -173,9 +542,27 @@ block_print_stats (void)
         {
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->stats.read_cnt, block->stats.write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      struct block_stats *stats = &block->stats;
+      if (block->ops->map != NULL
+          || stats->read_cnt + stats->write_cnt == 0)
+        continue;
+
+      print_histogram (block, "read", stats->read_hist);
+      print_histogram (block, "write", stats->write_hist);
+      printf ("%s: at most %"PRIu32" requests in flight, "
+              "controller lock held %llu cycles, "
+              "waited %llu cycles for interrupts\n",
+              block->name, stats->max_in_flight,
+              stats->lock_cycles, stats->intr_cycles);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -198,8 +585,17 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->head = 0;
+  if (ops->map == NULL)
+    {
+      char thread_name[16];
+      snprintf (thread_name, sizeof thread_name, "%s-io", name);
+      thread_create (thread_name, PRI_MAX, io_thread, block);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +607,19 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Adds LOCK_CYCLES to the time BLOCK's driver has held its
+   controller's lock and INTR_CYCLES to the time it has waited
+   for interrupts. */
+void
+block_add_driver_cycles (struct block *block, uint64_t lock_cycles,
+                         uint64_t intr_cycles)
+{
+  lock_acquire (&block->queue_lock);
+  block->stats.lock_cycles += lock_cycles;
+  block->stats.intr_cycles += intr_cycles;
+  lock_release (&block->queue_lock);
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -220,4 +629,3 @@ list_elem_to_block (struct list_elem *list_elem)
           ? list_entry (list_elem, struct block, list_elem)
           : NULL);
 }
-
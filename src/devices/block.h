@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +56,68 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
+
+/* Number of buckets in a latency histogram.  Bucket I counts the
+   requests that took 2**I to 2**(I+1) - 1 CPU cycles, from being
+   submitted to being finished; the last bucket also counts all
+   slower ones. */
+#define BLOCK_HIST_BUCKETS 32
+
+/* Statistics of a block device.  Latency and driver figures are
+   only gathered by devices with their own request queue, that is,
+   not by partitions. */
+struct block_stats
+  {
+    uint64_t read_cnt;                      /* Sectors read. */
+    uint64_t write_cnt;                     /* Sectors written. */
+    uint32_t read_hist[BLOCK_HIST_BUCKETS]; /* Read request latencies. */
+    uint32_t write_hist[BLOCK_HIST_BUCKETS]; /* Write request latencies. */
+    uint32_t in_flight;                     /* Requests queued or active. */
+    uint32_t max_in_flight;                 /* Highest IN_FLIGHT seen. */
+    uint64_t lock_cycles;                   /* Driver held controller lock. */
+    uint64_t intr_cycles;                   /* Driver waited for interrupts. */
+  };
+
+bool block_get_stats (const char *name, struct block_stats *);
 void block_print_stats (void);
+
+/* Asynchronous requests. */
+
+struct block_request;
+
+/* Called by a block device's I/O thread when request REQ
+   finishes. */
+typedef void block_done_func (struct block_request *req, void *aux);
+
+/* A request to transfer consecutive sectors.  Requests are queued
+   per device and may be reordered and merged with requests for
+   neighbouring sectors before they are carried out. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in device's queue. */
+    bool write;                 /* Write if true, read otherwise. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_done_func *done;      /* Completion function, or null. */
+    void *aux;                  /* Passed to DONE. */
+    struct semaphore finished;  /* Up'd on completion if DONE is null. */
+    uint64_t submitted;         /* rdtsc() when submitted. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +125,25 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer calls read or write once per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  For devices that are a window onto another
+       device, such as partitions: translates *SECTOR into a sector
+       of the underlying device and returns that device.  Requests
+       then go straight to the underlying device's queue. */
+    struct block *(*map) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_add_driver_cycles (struct block *, uint64_t lock_cycles,
+                              uint64_t intr_cycles);
 
 #endif /* devices/block.h */
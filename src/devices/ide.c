@@ -5,13 +5,19 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
+#include "threads/cpu.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+   If the controller is a PCI bus-master IDE controller, such as
+   the PIIX3 emulated by QEMU, sectors are transferred with DMA;
+   otherwise, or if a DMA transfer fails, with programmed I/O. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +36,28 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_ERROR 0x02       /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt raised (write 1 to clear). */
+
+/* PCI class and subclass of IDE controllers. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +73,22 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* A physical region descriptor, which tells the bus master where
+   in memory to transfer a piece of data. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, word aligned. */
+    uint16_t size;              /* Byte count, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT 4               /* Descriptors in a channel's table. */
+
+/* Most sectors a single READ or WRITE command can transfer. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +97,8 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer sectors with DMA? */
+    struct block *block;        /* Registered block device. */
   };
 
 /* An ATA channel (aka controller).
@@ -66,6 +108,7 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master I/O port, 0 if no DMA. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
@@ -73,6 +116,18 @@ struct channel
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    /* Statistics, protected by LOCK. */
+    unsigned long long cmd_cnt;     /* Number of read/write commands. */
+    unsigned long long sector_cnt;  /* Number of sectors transferred. */
+    int64_t busy_ticks;             /* Timer ticks spent transferring. */
+    int64_t busy_since;             /* Start of the current transfer. */
+    uint64_t intr_cycles;           /* CPU cycles waiting for interrupts
+                                       in the current transfer. */
+
+    /* PRD table for DMA.  The alignment keeps it from crossing a
+       64 kB boundary, which the bus master does not allow. */
+    struct prd prdt[PRD_CNT] __attribute__ ((aligned (sizeof (struct prd) * PRD_CNT)));
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -81,26 +136,42 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+/* Number of channels in the middle of a transfer, when that
+   number last became 2, and the total time it has been 2.
+   Updated with interrupts off. */
+static int busy_channel_cnt;
+static int64_t overlap_since;
+static int64_t overlap_ticks;
+
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static bool setup_prdt (struct channel *, const void *, size_t size);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          const void *, bool write);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static void wait_interrupt (struct channel *);
+static void channel_busy (struct channel *);
+static void channel_idle (struct channel *, size_t sector_cnt);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,8 +194,12 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      c->bm_base = bm_base != 0 ? bm_base + 8 * chan_no : 0;
       lock_init (&c->lock);
       c->expecting_interrupt = false;
+      c->cmd_cnt = c->sector_cnt = 0;
+      c->busy_ticks = 0;
+      c->intr_cycles = 0;
       sema_init (&c->completion_wait, 0);
  
       /* Initialize devices. */
@@ -136,6 +211,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
+          d->block = NULL;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +236,34 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks for a PCI bus-master IDE controller and enables bus
+   mastering on it.  Returns the base I/O port of its bus master
+   registers, or 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void) 
+{
+  struct pci_addr pci;
+  uint32_t bar, command;
+
+  /* Bit 7 of the programming interface says whether the
+     controller can act as a bus master. */
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)
+      || !(pci_read_config (pci, PCI_REG_CLASS) & 0x8000))
+    return 0;
+
+  /* BAR 4 holds the bus master registers, in I/O space. */
+  bar = pci_read_config (pci, PCI_REG_BAR (4));
+  if (!(bar & 1) || (bar & 0xfffc) == 0)
+    return 0;
+
+  /* Writing zeros to the upper half leaves the status bits, which
+     are cleared by writing ones, untouched. */
+  command = pci_read_config (pci, PCI_REG_COMMAND) & 0xffff;
+  pci_write_config (pci, PCI_REG_COMMAND,
+                    command | PCI_CMD_IO | PCI_CMD_MASTER);
+  return bar & 0xfffc;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -272,7 +377,7 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -284,6 +389,7 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->use_dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100);
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -306,6 +412,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
@@ -337,63 +444,145 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Issues one command per MAX_COMMAND_SECTORS sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+      uint64_t locked, lock_cycles, intr_cycles;
+      size_t i;
+
+      lock_acquire (&c->lock);
+      locked = rdtsc ();
+      channel_busy (c);
+      if (!dma_transfer (d, sec_no, n, p, false))
+        {
+          /* In PIO mode the disk interrupts once per sector, when
+             that sector's data is ready to be read. */
+          select_sector (d, sec_no, n);
+          issue_command (c, CMD_READ_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              wait_interrupt (c);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              input_sector (c, p + i * BLOCK_SECTOR_SIZE);
+            }
+        }
+      channel_idle (c, n);
+      intr_cycles = c->intr_cycles;
+      c->intr_cycles = 0;
+      lock_cycles = rdtsc () - locked;
+      lock_release (&c->lock);
+      block_add_driver_cycles (d->block, lock_cycles, intr_cycles);
+
+      sec_no += n;
+      cnt -= n;
+      p += n * BLOCK_SECTOR_SIZE;
+    }
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Issues one command per MAX_COMMAND_SECTORS sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  const uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+      uint64_t locked, lock_cycles, intr_cycles;
+      size_t i;
+
+      lock_acquire (&c->lock);
+      locked = rdtsc ();
+      channel_busy (c);
+      if (!dma_transfer (d, sec_no, n, p, true))
+        {
+          /* In PIO mode the disk asks for each sector's data in
+             turn and interrupts once it has taken it. */
+          select_sector (d, sec_no, n);
+          issue_command (c, CMD_WRITE_SECTOR_RETRY);
+          for (i = 0; i < n; i++)
+            {
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + i);
+              output_sector (c, p + i * BLOCK_SECTOR_SIZE);
+              wait_interrupt (c);
+            }
+        }
+      channel_idle (c, n);
+      intr_cycles = c->intr_cycles;
+      c->intr_cycles = 0;
+      lock_cycles = rdtsc () - locked;
+      lock_release (&c->lock);
+      block_add_driver_cycles (d->block, lock_cycles, intr_cycles);
+
+      sec_no += n;
+      cnt -= n;
+      p += n * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d, sec_no, 1, buffer);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_COMMAND_SECTORS);  /* 0 means 256. */
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +593,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -430,6 +619,145 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Fills in channel C's PRD table to describe the SIZE bytes at
+   BUFFER.  Returns false if BUFFER cannot be used for DMA. */
+static bool
+setup_prdt (struct channel *c, const void *buffer, size_t size)
+{
+  uintptr_t addr;
+  size_t i;
+
+  /* The bus master needs a physically contiguous, word-aligned
+     buffer.  Kernel virtual memory maps physical memory linearly,
+     so any aligned kernel buffer will do. */
+  if (!is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+    return false;
+
+  addr = vtop (buffer);
+  for (i = 0; i < PRD_CNT && size > 0; i++)
+    {
+      /* A region may not cross a 64 kB boundary. */
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      c->prdt[i].addr = addr;
+      c->prdt[i].size = chunk & 0xffff;
+      c->prdt[i].flags = 0;
+      addr += chunk;
+      size -= chunk;
+    }
+  if (size > 0)
+    return false;
+  c->prdt[i - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D and
+   BUFFER with bus-master DMA, writing to the disk if WRITE is true and reading
+   from it otherwise.  Returns false if D or BUFFER cannot be used
+   for DMA or the transfer fails, in which case the caller must
+   fall back to PIO.  A failure also turns off DMA for D.
+   D's channel lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffer, bool write) 
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status;
+
+  if (!d->use_dma || !setup_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  /* Point the bus master at the PRD table and clear any stale
+     status left by the previous transfer. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_ERROR | BM_STA_INTR);
+
+  /* Issue the command, then start the bus master.  The disk
+     interrupts once all the data has been transferred. */
+  select_sector (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  wait_interrupt (c);
+  outb (reg_bm_command (c), direction);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERROR | BM_STA_INTR);
+  if ((bm_status & BM_STA_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->use_dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Statistics. */
+
+/* Waits for channel C's completion interrupt and adds the time
+   spent to C's intr_cycles.  C's lock must be held. */
+static void
+wait_interrupt (struct channel *c)
+{
+  uint64_t start = rdtsc ();
+  sema_down (&c->completion_wait);
+  c->intr_cycles += rdtsc () - start;
+}
+
+/* Records that channel C, whose lock is held, starts a
+   transfer. */
+static void
+channel_busy (struct channel *c)
+{
+  enum intr_level old_level = intr_disable ();
+  c->busy_since = timer_ticks ();
+  if (++busy_channel_cnt == CHANNEL_CNT)
+    overlap_since = c->busy_since;
+  intr_set_level (old_level);
+}
+
+/* Records that channel C, whose lock is held, finished a
+   transfer of SECTOR_CNT sectors. */
+static void
+channel_idle (struct channel *c, size_t sector_cnt)
+{
+  enum intr_level old_level = intr_disable ();
+  int64_t now = timer_ticks ();
+  if (busy_channel_cnt-- == CHANNEL_CNT)
+    overlap_ticks += now - overlap_since;
+  intr_set_level (old_level);
+
+  c->busy_ticks += now - c->busy_since;
+  c->cmd_cnt++;
+  c->sector_cnt += sector_cnt;
+}
+
+/* Prints how much each channel transferred and for how long
+   both channels were transferring at the same time. */
+void
+ide_print_stats (void) 
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    {
+      if (c->cmd_cnt == 0)
+        continue;
+      printf ("%s: %llu commands, %llu sectors in %"PRId64" ticks",
+              c->name, c->cmd_cnt, c->sector_cnt, c->busy_ticks);
+      if (c->busy_ticks > 0)
+        printf (" (%llu sectors/s)",
+                c->sector_cnt * TIMER_FREQ / c->busy_ticks);
+      printf ("\n");
+    }
+  printf ("ide: both channels busy for %"PRId64" ticks\n", overlap_ticks);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
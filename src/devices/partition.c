@@ -1,4 +1,5 @@
 #include "devices/partition.h"
+#include <list.h>
 #include <packed.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,8 +12,12 @@ struct partition
   {
     struct block *block;                /* Underlying block device. */
     block_sector_t start;               /* First sector within device. */
+    struct list_elem elem;              /* Element in partitions. */
   };
 
+/* Every partition found. */
+static struct list partitions = LIST_INITIALIZER (partitions);
+
 static struct block_operations partition_operations;
 
 static void read_partition_table (struct block *, block_sector_t sector,
@@ -33,6 +38,20 @@ partition_scan (struct block *block)
     printf ("%s: Device contains no partitions\n", block_name (block));
 }
 
+/* Returns true if any partition of BLOCK has been registered as
+   a block device of its own. */
+bool
+partition_exists_on (struct block *block)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&partitions); e != list_end (&partitions);
+       e = list_next (e))
+    if (list_entry (e, struct partition, elem)->block == block)
+      return true;
+  return false;
+}
+
 /* Reads the partition table in the given SECTOR of BLOCK and
    scans it for partitions of interest to Pintos.
 
@@ -177,6 +196,7 @@ found_partition (struct block *block, uint8_t part_type,
         PANIC ("Failed to allocate memory for partition descriptor");
       p->block = block;
       p->start = start;
+      list_push_back (&partitions, &p->elem);
 
       snprintf (name, sizeof name, "%s%d", block_name (block), part_nr);
       snprintf (extra_info, sizeof extra_info, "%s (%02x)",
@@ -317,8 +337,21 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Translates SECTOR of partition P into a sector of the
+   underlying block device, which is returned. */
+static struct block *
+partition_map (void *p_, block_sector_t *sector)
+{
+  struct partition *p = p_;
+  *sector += p->start;
+  return p->block;
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    NULL,
+    NULL,
+    partition_map
   };
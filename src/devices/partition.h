@@ -1,8 +1,11 @@
 #ifndef DEVICES_PARTITION_H
 #define DEVICES_PARTITION_H
 
+#include <stdbool.h>
+
 struct block;
 
 void partition_scan (struct block *);
+bool partition_exists_on (struct block *);
 
 #endif /* devices/partition.h */
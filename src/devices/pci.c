@@ -0,0 +1,77 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* This code reads and writes PCI configuration space through
+   configuration mechanism #1, which every PC chipset that QEMU
+   and Bochs emulate supports.  See [PCI] for details. */
+
+/* Configuration mechanism #1 I/O ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8        /* Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc           /* Selected register's data. */
+
+/* Returns the value to write to PCI_CONFIG_ADDRESS to select
+   register REG of function A. */
+static uint32_t
+config_address (struct pci_addr a, uint8_t reg)
+{
+  return (0x80000000 | ((uint32_t) a.bus << 16) | ((uint32_t) a.dev << 11)
+          | ((uint32_t) a.func << 8) | (reg & 0xfc));
+}
+
+/* Reads the 32-bit configuration register REG of function A.
+   REG must be a multiple of 4. */
+uint32_t
+pci_read_config (struct pci_addr a, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS, config_address (a, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG of
+   function A.  REG must be a multiple of 4. */
+void
+pci_write_config (struct pci_addr a, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, config_address (a, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Searches every PCI bus for the first function with the given
+   CLASS and SUBCLASS codes.  If one is found, stores its location
+   in *A and returns true; otherwise returns false, which is also
+   the result on a machine without PCI. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *a)
+{
+  unsigned bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          struct pci_addr cur = { bus, dev, func };
+          uint32_t class_reg;
+
+          if ((pci_read_config (cur, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No function 0 means no device at all. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class_reg = pci_read_config (cur, PCI_REG_CLASS);
+          if ((class_reg >> 24) == class
+              && ((class_reg >> 16) & 0xff) == subclass)
+            {
+              *a = cur;
+              return true;
+            }
+
+          /* Only multi-function devices have functions 1...7. */
+          if (func == 0
+              && !(pci_read_config (cur, PCI_REG_HEADER) & 0x800000))
+            break;
+        }
+  return false;
+}
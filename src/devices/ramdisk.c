@@ -0,0 +1,91 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in kernel memory.  Its contents do not
+   survive a reboot, but accesses to it cost no emulated disk
+   latency, which makes it useful for measuring the file system
+   code itself and as fast scratch space. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Pages that hold the sectors. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/* Registers a zero-filled RAM disk named "ram0" of SIZE_KB
+   kilobytes, rounded up to whole pages, backed by pages from the
+   kernel pool.  Panics if there is not enough memory. */
+void
+ramdisk_init (size_t size_kb)
+{
+  struct ramdisk *r;
+  size_t i;
+
+  ASSERT (size_kb > 0);
+
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    PANIC ("Failed to allocate memory for RAM disk descriptor");
+  r->page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  r->pages = malloc (r->page_cnt * sizeof *r->pages);
+  if (r->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk page table");
+
+  /* The pages need not be contiguous, so a large RAM disk does
+     not depend on fragmentation of the kernel pool. */
+  for (i = 0; i < r->page_cnt; i++)
+    {
+      r->pages[i] = palloc_get_page (PAL_ZERO);
+      if (r->pages[i] == NULL)
+        PANIC ("RAM disk: out of kernel memory after %zu of %zu pages",
+               i, r->page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  r->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, r);
+}
+
+/* Returns the address of sector SECTOR of RAM disk R. */
+static uint8_t *
+sector_addr (struct ramdisk *r, block_sector_t sector)
+{
+  return (r->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RAM disk R_ into BUFFER. */
+static void
+ramdisk_read (void *r_, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_addr (r_, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR to RAM disk R_ from BUFFER. */
+static void
+ramdisk_write (void *r_, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_addr (r_, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL
+  };
@@ -0,0 +1,184 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "threads/malloc.h"
+
+/* A striped ("RAID 0") block device, which spreads its sectors
+   over several member devices in chunks of CHUNK_SECTORS, so
+   that chunk N lives on member N % member_cnt.  A large transfer
+   touches every member, and members on different IDE channels
+   work on it at the same time. */
+
+/* Sectors per chunk. */
+#define CHUNK_SECTORS 8
+
+/* Most members a striped device can have. */
+#define MAX_MEMBERS 4
+
+/* Most chunk requests in flight per transfer. */
+#define MAX_REQUESTS 8
+
+/* A striped block device. */
+struct stripe
+  {
+    struct block *members[MAX_MEMBERS]; /* Member devices. */
+    size_t member_cnt;                  /* Number of members. */
+  };
+
+static struct block_operations stripe_operations;
+
+/* The striped device, or NULL if there is none. */
+static struct stripe *stripe;
+
+/* Registers a striped block device named "stripe0" over the
+   block devices named in NAMES, a comma-separated list of two to
+   MAX_MEMBERS names such as "hdb,hdc".  The members must be
+   raw disks without partitions, ideally on different channels,
+   and are not available for any role afterwards.  Panics on a
+   bad list. */
+void
+stripe_init (char *names)
+{
+  struct stripe *s;
+  block_sector_t chunks, size;
+  char extra_info[128];
+  char *name, *save_ptr;
+  size_t i;
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for striped device descriptor");
+
+  s->member_cnt = 0;
+  strlcpy (extra_info, "striped over", sizeof extra_info);
+  for (name = strtok_r (names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *member = block_get_by_name (name);
+      if (member == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      if (block_type (member) != BLOCK_RAW)
+        PANIC ("Block device \"%s\" is not a raw disk", name);
+      if (partition_exists_on (member))
+        PANIC ("Block device \"%s\" has partitions", name);
+      for (i = 0; i < s->member_cnt; i++)
+        if (s->members[i] == member)
+          PANIC ("Block device \"%s\" listed twice", name);
+      if (s->member_cnt >= MAX_MEMBERS)
+        PANIC ("Striped device has more than %d members", MAX_MEMBERS);
+
+      s->members[s->member_cnt++] = member;
+      strlcat (extra_info, " ", sizeof extra_info);
+      strlcat (extra_info, name, sizeof extra_info);
+    }
+  if (s->member_cnt < 2)
+    PANIC ("Striped device needs at least two members");
+
+  /* Every member contributes as many whole chunks as the
+     smallest one has. */
+  chunks = block_size (s->members[0]) / CHUNK_SECTORS;
+  for (i = 1; i < s->member_cnt; i++)
+    if (block_size (s->members[i]) / CHUNK_SECTORS < chunks)
+      chunks = block_size (s->members[i]) / CHUNK_SECTORS;
+  size = chunks * CHUNK_SECTORS * s->member_cnt;
+
+  block_register ("stripe0", BLOCK_RAW, extra_info, size,
+                  &stripe_operations, s);
+  stripe = s;
+}
+
+/* Returns true if BLOCK is a member of the striped device, so
+   that it must not be used for anything else. */
+bool
+stripe_has_member (struct block *block)
+{
+  size_t i;
+
+  if (stripe != NULL)
+    for (i = 0; i < stripe->member_cnt; i++)
+      if (stripe->members[i] == block)
+        return true;
+  return false;
+}
+
+/* Transfers the CNT sectors starting at SECTOR between striped
+   device S and BUFFER, writing if WRITE is true.  Chunk requests
+   are submitted to all members before waiting for any of them. */
+static void
+stripe_transfer (struct stripe *s, block_sector_t sector, size_t cnt,
+                 void *buffer, bool write)
+{
+  uint8_t *p = buffer;
+
+  while (cnt > 0)
+    {
+      struct block_request reqs[MAX_REQUESTS];
+      size_t req_cnt, i;
+
+      for (req_cnt = 0; req_cnt < MAX_REQUESTS && cnt > 0; req_cnt++)
+        {
+          block_sector_t chunk = sector / CHUNK_SECTORS;
+          size_t chunk_ofs = sector % CHUNK_SECTORS;
+          size_t chunk_left = CHUNK_SECTORS - chunk_ofs;
+          size_t n = cnt < chunk_left ? cnt : chunk_left;
+          struct block *member = s->members[chunk % s->member_cnt];
+          block_sector_t member_sector
+            = chunk / s->member_cnt * CHUNK_SECTORS + chunk_ofs;
+
+          block_request_init (&reqs[req_cnt], write, member_sector, n, p,
+                              NULL, NULL);
+          block_submit (member, &reqs[req_cnt]);
+
+          sector += n;
+          cnt -= n;
+          p += n * BLOCK_SECTOR_SIZE;
+        }
+
+      for (i = 0; i < req_cnt; i++)
+        block_wait (&reqs[i]);
+    }
+}
+
+/* Reads sector SECTOR from striped device S into BUFFER. */
+static void
+stripe_read (void *s, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s, sector, 1, buffer, false);
+}
+
+/* Writes sector SECTOR to striped device S from BUFFER. */
+static void
+stripe_write (void *s, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s, sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from striped device S
+   into BUFFER. */
+static void
+stripe_read_multiple (void *s, block_sector_t sector, size_t cnt,
+                      void *buffer)
+{
+  stripe_transfer (s, sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to striped device S from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s, block_sector_t sector, size_t cnt,
+                       const void *buffer)
+{
+  stripe_transfer (s, sector, cnt, (void *) buffer, true);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple,
+    NULL
+  };
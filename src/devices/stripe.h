@@ -0,0 +1,11 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stdbool.h>
+
+struct block;
+
+void stripe_init (char *names);
+bool stripe_has_member (struct block *);
+
+#endif /* devices/stripe.h */
@@ -0,0 +1,49 @@
+/* iostat.c
+
+   Prints the statistics of each block device named on the
+   command line, e.g. "iostat hda hdb". */
+
+#include <stdio.h>
+#include <syscall.h>
+
+/* Prints the nonempty buckets of latency histogram HIST. */
+static void
+print_histogram (const char *what, const uint32_t *hist)
+{
+  int i;
+
+  printf ("  %s latency (log2 cycles: count):", what);
+  for (i = 0; i < BLOCKSTATS_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %d:%u", i, (unsigned) hist[i]);
+  printf ("\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool success = true;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      struct blockstats stats;
+
+      if (!blockstats (argv[i], &stats))
+        {
+          printf ("%s: no such block device\n", argv[i]);
+          success = false;
+          continue;
+        }
+      printf ("%s: %llu sectors read, %llu sectors written\n",
+              argv[i], stats.read_cnt, stats.write_cnt);
+      print_histogram ("read", stats.read_hist);
+      print_histogram ("write", stats.write_hist);
+      printf ("  %u requests in flight, at most %u\n",
+              (unsigned) stats.in_flight, (unsigned) stats.max_in_flight);
+      printf ("  controller lock held %llu cycles, "
+              "waited %llu cycles for interrupts\n",
+              stats.lock_cycles, stats.intr_cycles);
+    }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
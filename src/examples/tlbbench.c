@@ -0,0 +1,60 @@
+/* tlbbench.c
+
+   Compares the cost of touching every page of a 4 MB region
+   mapped with ordinary 4 kB pages against one mapped with a
+   single large page.  A pass over 1,024 pages needs far more TLB
+   entries than the CPU has, so the first region misses the TLB
+   on nearly every access, while the second needs one entry.
+
+   Both regions have to be in memory at once, so run it with
+   enough of it, e.g. "pintos -m 32 ... run tlbbench". */
+
+#include <stdio.h>
+#include <syscall.h>
+
+/* Size of each region, one large page. */
+#define REGION (4 * 1024 * 1024)
+
+/* Size of a page. */
+#define PAGE 4096
+
+/* Number of passes over each region. */
+#define PASSES 2000
+
+static char small[REGION] __attribute__ ((aligned (REGION)));
+static char large[REGION] __attribute__ ((aligned (REGION)));
+
+/* Reads one byte from each page of REGION, PASSES times, and
+   returns the number of timer ticks it took. */
+static int
+time_passes (const volatile char *region)
+{
+  int start = ticks ();
+  int sum = 0;
+  int pass, ofs;
+
+  for (pass = 0; pass < PASSES; pass++)
+    for (ofs = 0; ofs < REGION; ofs += PAGE)
+      sum += region[ofs];
+  if (sum != 0)
+    printf ("tlbbench: regions should be zero\n");
+  return ticks () - start;
+}
+
+int
+main (void)
+{
+  int ofs;
+
+  /* The region must not have been touched yet. */
+  if (!largepage (large))
+    printf ("tlbbench: no large page, both regions use 4 kB pages\n");
+
+  /* Fault every page in before timing. */
+  for (ofs = 0; ofs < REGION; ofs += PAGE)
+    small[ofs] = large[ofs] = 0;
+
+  printf ("tlbbench: 4 kB pages: %d ticks\n", time_passes (small));
+  printf ("tlbbench: 4 MB page: %d ticks\n", time_passes (large));
+  return EXIT_SUCCESS;
+}
@@ -2,16 +2,21 @@
 #include "filesys/filesys.h"
 #include "devices/timer.h"
 #include "lib/string.h"
+#include "threads/malloc.h"
 
 #define CACHE_SIZE 64
 #define CACHE_LINE_INVALID (-1)
+/* Maximum number of dirty lines written back by one disk command */
+#define WRITE_BACK_CLUSTER 16
 typedef int cache_id_t;
 
 static cache_id_t cache_line_find(block_sector_t id);
-static void cache_line_flush(cache_id_t id);
-static cache_id_t evict_cache_line();
-static cache_id_t load_from_disk_to_cache(block_sector_t sector);
+static cache_id_t cache_get_line(block_sector_t sector,bool load);
+static cache_id_t evict_cache_line(void);
+static void write_back(cache_id_t id);
 static struct lock cache_lock;
+/* Broadcast whenever a cache line finishes its disk I/O */
+static struct condition cache_io_done;
 
 struct cache buffer_cache[CACHE_SIZE];
 
@@ -23,9 +28,11 @@ cache_init()
   {
     buffer_cache[i].valid = false;
     buffer_cache[i].dirty = false;
+    buffer_cache[i].busy = false;
     buffer_cache[i].last_accessed_time = 0;
   }
   lock_init(&cache_lock);
+  cond_init(&cache_io_done);
 }
 
 /* Read SECTOR from cache into buffer */
@@ -33,16 +40,7 @@ void
 cache_read(block_sector_t sector,void * buffer)
 {
   lock_acquire(&cache_lock);
-  cache_id_t cache_id = cache_line_find(sector);
-
-  if(cache_id == CACHE_LINE_INVALID)
-  {
-    cache_id = load_from_disk_to_cache(sector);
-    buffer_cache[cache_id].dirty = false;
-  }
-
-  buffer_cache[cache_id].sector = sector;
-  buffer_cache[cache_id].valid = true;
+  cache_id_t cache_id = cache_get_line(sector,true);
   buffer_cache[cache_id].last_accessed_time = timer_ticks();
   memcpy(buffer,buffer_cache[cache_id].data,BLOCK_SECTOR_SIZE);
   lock_release(&cache_lock);
@@ -53,65 +51,191 @@ void
 cache_write(block_sector_t sector,void * buffer)
 {
   lock_acquire(&cache_lock);
-  cache_id_t cache_id = cache_line_find(sector);
-
-  if(cache_id == CACHE_LINE_INVALID)
-    cache_id = load_from_disk_to_cache(sector);
-
-  buffer_cache[cache_id].sector = sector;
+  // the whole sector is overwritten, so there is no need to read it first
+  cache_id_t cache_id = cache_get_line(sector,false);
   buffer_cache[cache_id].dirty = true;
-  buffer_cache[cache_id].valid = true;
   buffer_cache[cache_id].last_accessed_time = timer_ticks();
   memcpy(buffer_cache[cache_id].data,buffer,BLOCK_SECTOR_SIZE);
   lock_release(&cache_lock);
 }
 
+/* Drop SECTOR from the cache without writing it back, as it has
+   been allocated to hold file data, which is kept in the page
+   cache instead, and its old contents are no longer needed */
+void
+cache_discard(block_sector_t sector)
+{
+  lock_acquire(&cache_lock);
+  cache_id_t id;
+  while((id = cache_line_find(sector)) != CACHE_LINE_INVALID
+        && buffer_cache[id].busy)
+    cond_wait(&cache_io_done,&cache_lock);
+  if(id != CACHE_LINE_INVALID)
+  {
+    buffer_cache[id].valid = false;
+    buffer_cache[id].dirty = false;
+  }
+  lock_release(&cache_lock);
+}
 
-/* Load data from disk at SECTOR into cache and return the cache line id */
+/* Return the id of a cache line that holds SECTOR and is not busy.
+   On a miss a line is assigned to SECTOR, and its data is read from
+   disk if LOAD is true.
+   Must be called with cache_lock held.  The lock is released
+   during disk I/O, so other threads can use the rest of the cache
+   meanwhile. */
 static cache_id_t
-load_from_disk_to_cache(block_sector_t sector)
+cache_get_line(block_sector_t sector,bool load)
 {
-  cache_id_t id = evict_cache_line();
-  block_read(fs_device,sector,buffer_cache[id].data);
-  return id;
+  for(;;)
+  {
+    cache_id_t id = cache_line_find(sector);
+    if(id != CACHE_LINE_INVALID)
+    {
+      if(!buffer_cache[id].busy)
+        return id;
+      // wait for the I/O on this line, then look again
+      cond_wait(&cache_io_done,&cache_lock);
+      continue;
+    }
+
+    id = evict_cache_line();
+    // the lock was released while evicting, so look again
+    if(id == CACHE_LINE_INVALID)
+      continue;
+
+    buffer_cache[id].sector = sector;
+    buffer_cache[id].valid = true;
+    buffer_cache[id].dirty = false;
+    if(load)
+    {
+      buffer_cache[id].busy = true;
+      lock_release(&cache_lock);
+      block_read(fs_device,sector,buffer_cache[id].data);
+      lock_acquire(&cache_lock);
+      buffer_cache[id].busy = false;
+      cond_broadcast(&cache_io_done,&cache_lock);
+    }
+    return id;
+  }
 }
 
-/* Evict a cache line to the disk and return id of the free cache line */
+/* Return the id of a free cache line, evicting the least recently
+   used clean line if necessary.
+   If the victim is dirty, it is written back with cache_lock
+   released and CACHE_LINE_INVALID is returned, so the caller must
+   look up its sector again. */
 static cache_id_t
 evict_cache_line()
 {
   // find the invalid cache line
   for(int i=0;i<CACHE_SIZE;i++)
   {
-    if(buffer_cache[i].valid == false)
+    if(buffer_cache[i].valid == false && !buffer_cache[i].busy)
       return i;
   }
 
   // apply LRU
-  cache_id_t victim_id = -1;
+  cache_id_t victim_id = CACHE_LINE_INVALID;
   uint32_t earlies_accessed_time = INT32_MAX;
   for(int i=0;i<CACHE_SIZE;i++)
   {
-    if(buffer_cache[i].last_accessed_time<earlies_accessed_time)
+    if(!buffer_cache[i].busy && buffer_cache[i].last_accessed_time<earlies_accessed_time)
     {
       victim_id = i;
       earlies_accessed_time = buffer_cache[i].last_accessed_time;
     }
   }
-  
-  cache_line_flush(victim_id);
 
+  // every line is in the middle of I/O
+  if(victim_id == CACHE_LINE_INVALID)
+  {
+    cond_wait(&cache_io_done,&cache_lock);
+    return CACHE_LINE_INVALID;
+  }
+
+  struct cache * victim = &buffer_cache[victim_id];
+  if(victim->dirty)
+  {
+    write_back(victim_id);
+    // the line is clean now, unless it was written meanwhile
+    if(!victim->dirty && !victim->busy)
+      victim->valid = false;
+    return CACHE_LINE_INVALID;
+  }
+  victim->valid = false;
   return victim_id;
 }
 
-/* Flush a cache line to the disk */
+/* Return the id of the dirty, idle line that holds SECTOR, or
+   CACHE_LINE_INVALID if there is none */
+static cache_id_t
+dirty_line_find(block_sector_t sector)
+{
+  cache_id_t id = cache_line_find(sector);
+  if(id != CACHE_LINE_INVALID
+     && (!buffer_cache[id].dirty || buffer_cache[id].busy))
+    return CACHE_LINE_INVALID;
+  return id;
+}
+
+/* Write the dirty line ID back to disk, together with the dirty
+   lines that hold the sectors right before and after it, so that
+   one disk command writes the whole run.
+   Must be called with cache_lock held.  The lock is released
+   during disk I/O. */
 static void
-cache_line_flush(cache_id_t id)
+write_back(cache_id_t id)
 {
-  if(buffer_cache[id].dirty && buffer_cache[id].valid)
-    block_write(fs_device,buffer_cache[id].sector,buffer_cache[id].data);
-  buffer_cache[id].dirty = false;
-  buffer_cache[id].valid = false;
+  cache_id_t run[WRITE_BACK_CLUSTER];
+  block_sector_t first = buffer_cache[id].sector;
+  int cnt = 1;
+
+  // find where the run of dirty sectors starts
+  while(cnt < WRITE_BACK_CLUSTER && first > 0
+        && dirty_line_find(first-1) != CACHE_LINE_INVALID)
+  {
+    first--;
+    cnt++;
+  }
+  // then collect it from there
+  cnt = 0;
+  for(block_sector_t sector = first;cnt < WRITE_BACK_CLUSTER;sector++)
+  {
+    cache_id_t line = dirty_line_find(sector);
+    if(line == CACHE_LINE_INVALID)
+      break;
+    run[cnt++] = line;
+  }
+
+  // fall back to writing just ID if there is no memory for a run
+  uint8_t * buffer = cnt > 1 ? malloc(cnt*BLOCK_SECTOR_SIZE) : NULL;
+  if(buffer == NULL)
+  {
+    run[0] = id;
+    first = buffer_cache[id].sector;
+    cnt = 1;
+  }
+
+  for(int i=0;i<cnt;i++)
+  {
+    buffer_cache[run[i]].busy = true;
+    if(buffer != NULL)
+      memcpy(buffer+i*BLOCK_SECTOR_SIZE,buffer_cache[run[i]].data,BLOCK_SECTOR_SIZE);
+  }
+  lock_release(&cache_lock);
+  if(buffer != NULL)
+    block_write_multiple(fs_device,first,cnt,buffer);
+  else
+    block_write(fs_device,first,buffer_cache[id].data);
+  lock_acquire(&cache_lock);
+  for(int i=0;i<cnt;i++)
+  {
+    buffer_cache[run[i]].busy = false;
+    buffer_cache[run[i]].dirty = false;
+  }
+  cond_broadcast(&cache_io_done,&cache_lock);
+  free(buffer);
 }
 
 /* Find the cache line which contains the SECTOR, return cache line id if finded,
@@ -133,6 +257,13 @@ cache_done()
 {
   lock_acquire(&cache_lock);
   for(int i=0;i<CACHE_SIZE;i++)
-    cache_line_flush(i);
+  {
+    while(buffer_cache[i].busy)
+      cond_wait(&cache_io_done,&cache_lock);
+    if(buffer_cache[i].dirty && buffer_cache[i].valid)
+      write_back(i);
+    buffer_cache[i].dirty = false;
+    buffer_cache[i].valid = false;
+  }
   lock_release(&cache_lock);
-}
\ No newline at end of file
+}
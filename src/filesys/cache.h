@@ -10,6 +10,8 @@ struct cache
     bool dirty;
     /* True if valid */
     bool valid;
+    /* True while the line is being read from or written to disk */
+    bool busy;
     /* Corresponding sector index */
     block_sector_t sector;
     /* Last accessed time */
@@ -20,6 +22,7 @@ struct cache
 
 void cache_read(block_sector_t sector,void * buffer);
 void cache_write(block_sector_t sector,void * buffer);
+void cache_discard(block_sector_t sector);
 void cache_init();
 void cache_done();
 #endif
\ No newline at end of file
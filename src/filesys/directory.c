@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -22,6 +23,9 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+static void dir_compact (struct dir *dir);
+static bool is_empty (struct inode *inode);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -73,6 +77,12 @@ dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
+      /* Trim freed entries off the end once nobody else has the
+         directory open, so that no other reader's position can
+         point past the new end. */
+      if (dir->inode->dir_compact && !dir->inode->removed
+          && inode_open_cnt (dir->inode) == 1)
+        dir_compact (dir);
       inode_close (dir->inode);
       free (dir);
     }
@@ -89,7 +99,8 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   The caller must hold DIR's directory lock. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
@@ -126,10 +137,14 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* The inode is opened before releasing the lock, so that a
+     concurrent dir_remove() cannot free it in between. */
+  lock_acquire (&dir->inode->dir_lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  lock_release (&dir->inode->dir_lock);
 
   return *inode != NULL;
 }
@@ -172,19 +187,22 @@ dir_add (struct dir *par_dir, const char *name, block_sector_t inode_sector,int
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (par_dir, name, NULL, NULL))
+  lock_acquire (&par_dir->inode->dir_lock);
+
+  /* Check that the directory still exists and that NAME is not in
+     use. */
+  if (par_dir->inode->removed || lookup (par_dir, name, NULL, NULL))
     goto done;
 
   if(is_dir)
   {
     struct dir * child_dir = dir_open(inode_open(inode_sector));
     if(!child_dir)
-      return false;
+      goto done;
     if(!dir_add_parent_and_self(par_dir,child_dir))
     {
       dir_close(child_dir);
-      return false;
+      goto done;
     }
     dir_close(child_dir);
   }
@@ -192,11 +210,14 @@ dir_add (struct dir *par_dir, const char *name, block_sector_t inode_sector,int
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
+     The scan starts at the inode's free slot hint, since every
+     entry before it is known to be in use.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (par_dir->inode, &e, sizeof e, ofs) == sizeof e;
+  for (ofs = par_dir->inode->dir_free_ofs;
+       inode_read_at (par_dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (!e.in_use)
       break;
@@ -206,8 +227,11 @@ dir_add (struct dir *par_dir, const char *name, block_sector_t inode_sector,int
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (par_dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    par_dir->inode->dir_free_ofs = ofs + sizeof e;
 
  done:
+  lock_release (&par_dir->inode->dir_lock);
   return success;
 }
 
@@ -220,11 +244,14 @@ dir_remove (struct dir *dir, const char *name)
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
+  bool child_locked = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir->inode->dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -236,30 +263,64 @@ dir_remove (struct dir *dir, const char *name)
   // cannot remove non-empty dir
   if(inode->data.is_dir)
   {
-    struct dir * temp = dir_open(inode);
-    if(!dir_is_empty(temp))
-    {
-      dir_close(temp);
+    /* Keep the child locked until it is marked removed, so that
+       nothing can be added to it after it was found empty. */
+    lock_acquire (&inode->dir_lock);
+    child_locked = true;
+    if(!is_empty(inode))
       goto done;
-    }
-    else
-      dir_close(temp);
   }
 
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (ofs < dir->inode->dir_free_ofs)
+    dir->inode->dir_free_ofs = ofs;
+  /* Freed an entry in the last sector, which may now be empty. */
+  if (ofs + (off_t) sizeof e > ROUND_DOWN (inode_length (dir->inode) - 1,
+                                           BLOCK_SECTOR_SIZE))
+    dir->inode->dir_compact = true;
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (child_locked)
+    lock_release (&inode->dir_lock);
   inode_close (inode);
+  lock_release (&dir->inode->dir_lock);
   return success;
 }
 
+/* Shrinks DIR so that it ends right after its last entry in
+   use, releasing the trailing sectors that hold only free
+   entries. */
+static void
+dir_compact (struct dir *dir)
+{
+  struct dir_entry e;
+  off_t ofs;
+  off_t end = 0;
+
+  lock_acquire (&dir->inode->dir_lock);
+  dir->inode->dir_compact = false;
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use)
+      end = ofs + sizeof e;
+
+  if (DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE)
+      < DIV_ROUND_UP (inode_length (dir->inode), BLOCK_SECTOR_SIZE))
+    {
+      inode_shrink (dir->inode, end);
+      if (dir->inode->dir_free_ofs > end)
+        dir->inode->dir_free_ofs = end;
+    }
+  lock_release (&dir->inode->dir_lock);
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
@@ -267,17 +328,74 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  lock_acquire (&dir->inode->dir_lock);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  lock_release (&dir->inode->dir_lock);
+  return success;
+}
+
+/* Reads up to CNT in-use entries from DIR, starting at its
+   current position, into RECORDS.  Returns the number of entries
+   stored, which is 0 once the directory contains no more entries.
+   Unlike dir_readdir(), the entries are read from the inode a
+   sector's worth at a time.  Whether an entry is a directory is
+   not kept in the entry, so its inode is opened to find out; that
+   is usually a hit in the buffer cache. */
+size_t
+dir_readdir_multiple (struct dir *dir, struct dir_record *records, size_t cnt)
+{
+  size_t chunk_cnt = BLOCK_SECTOR_SIZE / sizeof (struct dir_entry);
+  struct dir_entry *chunk;
+  size_t filled = 0;
+
+  chunk = malloc (chunk_cnt * sizeof *chunk);
+  if (chunk == NULL)
+    return 0;
+
+  lock_acquire (&dir->inode->dir_lock);
+  while (filled < cnt)
+    {
+      size_t read_cnt = inode_read_at (dir->inode, chunk,
+                                       chunk_cnt * sizeof *chunk,
+                                       dir->pos) / sizeof *chunk;
+      size_t i;
+
+      if (read_cnt == 0)
+        break;
+      for (i = 0; i < read_cnt && filled < cnt; i++)
+        {
+          if (chunk[i].in_use)
+            {
+              /* Opened under the lock, like in dir_lookup(), so
+                 that dir_remove() cannot free it meanwhile.  Out
+                 of memory, stop here and return what we have. */
+              struct inode *inode = inode_open (chunk[i].inode_sector);
+              if (inode == NULL)
+                goto done;
+              records[filled].inumber = chunk[i].inode_sector;
+              records[filled].is_dir = inode->data.is_dir != 0;
+              strlcpy (records[filled].name, chunk[i].name, NAME_MAX + 1);
+              inode_close (inode);
+              filled++;
+            }
+          dir->pos += sizeof *chunk;
+        }
+    }
+ done:
+  lock_release (&dir->inode->dir_lock);
+  free (chunk);
+  return filled;
 }
 
 /* Split dir_path and file_name according to path_ */
@@ -369,11 +487,13 @@ dir_open_path(const char * path_)
 
 }
 
-bool
-dir_is_empty(struct dir * dir)
+/* Returns true if directory INODE contains no entries besides
+   "." and "..".  The caller must hold INODE's directory lock. */
+static bool
+is_empty(struct inode * inode)
 {
   struct dir_entry e;
-  for(int ofs = 0;inode_read_at(dir->inode,&e,sizeof(e),ofs) == sizeof(e);ofs+=sizeof(e))
+  for(int ofs = 0;inode_read_at(inode,&e,sizeof(e),ofs) == sizeof(e);ofs+=sizeof(e))
   {
     if(e.in_use)
     {
@@ -387,4 +507,13 @@ dir_is_empty(struct dir * dir)
     }
   }
   return true;
+}
+
+bool
+dir_is_empty(struct dir * dir)
+{
+  lock_acquire(&dir->inode->dir_lock);
+  bool empty = is_empty(dir->inode);
+  lock_release(&dir->inode->dir_lock);
+  return empty;
 }
\ No newline at end of file
@@ -13,6 +13,16 @@
 
 struct inode;
 
+/* Directory entry as reported by dir_readdir_multiple().
+   The layout is shared with user programs through the
+   getdents system call. */
+struct dir_record
+  {
+    block_sector_t inumber;             /* Sector number of header. */
+    bool is_dir;                        /* Is a directory? */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -26,6 +36,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t,int);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_multiple (struct dir *, struct dir_record *, size_t cnt);
 void path_split(const char* path,char* dir_path, char* file_name);
 struct dir * dir_open_path(const char * path_);
 bool dir_is_empty(struct dir * dir);
@@ -2,6 +2,14 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "devices/block.h"
+
+/* Read-ahead window, in sectors, after the first sequential read
+   and the most it may grow to.  Read-ahead brings in whole pages,
+   so the window starts at one page, and the maximum is kept well
+   below the size of the page cache. */
+#define READ_AHEAD_MIN 8
+#define READ_AHEAD_MAX 64
 
 /* An open file. */
 struct file 
@@ -9,8 +17,13 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* Read-ahead issued up to this offset. */
+    int ra_window;              /* Read-ahead window in sectors, 0 if off. */
   };
 
+static void file_read_ahead (struct file *, off_t start);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +36,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -68,11 +84,46 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
+  off_t start = file->pos;
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file_read_ahead (file, start);
   return bytes_read;
 }
 
+/* Updates FILE's read-ahead window after a read that started at
+   START and ended at the file's current position, then prefetches
+   the part of the window that has not been requested yet.
+   A read that continues where the previous one stopped doubles the
+   window; any other read collapses it. */
+static void
+file_read_ahead (struct file *file, off_t start)
+{
+  if (start == file->ra_next)
+    {
+      file->ra_window = file->ra_window == 0 ? READ_AHEAD_MIN
+                                             : file->ra_window * 2;
+      if (file->ra_window > READ_AHEAD_MAX)
+        file->ra_window = READ_AHEAD_MAX;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = file->pos;
+
+  if (file->ra_window == 0)
+    return;
+  off_t end = file->pos + file->ra_window * BLOCK_SECTOR_SIZE;
+  off_t begin = file->ra_end > file->pos ? file->ra_end : file->pos;
+  if (begin < end)
+    {
+      inode_read_ahead (file->inode, begin, end - begin);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/page-cache.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 
@@ -37,7 +38,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_flush_all ();
   free_map_close ();
+  pcache_done ();
   cache_done();
 }
 
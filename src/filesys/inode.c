@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
 #include "filesys/cache.h"
+#include "filesys/page-cache.h"
 #include "lib/kernel/bitmap.h"
 
 /* Identifies an inode. */
@@ -16,6 +17,11 @@
 
 static void get_block_num(int sectors,int* direct_num,int*indirect_num,int * double_indirect_num);
 static void inode_disk_remove(struct inode * inode);
+struct sector_buf;
+static void write_pages(block_sector_t inode_sector,
+                        const struct inode_disk * disk_inode,
+                        const uint8_t * buffer,off_t size,off_t offset,
+                        off_t old_length,struct sector_buf * buf);
 bool inode_extend(struct inode_disk * disk_inode,int length);
 
 
@@ -29,58 +35,82 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+/* Blocks of sector numbers read by page_sectors().  Callers
+   allocate it before they change anything, since a kernel stack
+   has no room for it. */
+struct sector_buf
+  {
+    block_sector_t outer[POINTER_PER_SECTOR]; /* Double indirect block. */
+    block_sector_t inner[POINTER_PER_SECTOR]; /* Indirect block. */
+  };
+
+/* Stores in SECTORS the block device sector that holds each part
+   of page INDEX of the file whose on-disk inode is DISK_INODE, or
+   PCACHE_NO_SECTOR for the parts past end of file.  Each block of
+   sector numbers that the page needs is read into BUF only once. */
+static void
+page_sectors (const struct inode_disk *disk_inode, size_t index,
+              block_sector_t sectors[PCACHE_SECTORS], struct sector_buf *buf)
 {
-  ASSERT (inode != NULL);
-  if(pos>=inode->data.length)
-    return -1;
-
-  int sector_idx_direct = pos/BLOCK_SECTOR_SIZE;
-
-  if(sector_idx_direct<DIRECT_INDEX_MAX)
-    return inode->data.direct[sector_idx_direct];
+  block_sector_t outer = PCACHE_NO_SECTOR, inner = PCACHE_NO_SECTOR;
 
-  int sector_idx_indirect = sector_idx_direct-DIRECT_BLOCK_NUMBER;
+  for (int i = 0; i < PCACHE_SECTORS; i++)
+    {
+      off_t pos = (off_t) index * PGSIZE + i * BLOCK_SECTOR_SIZE;
+      size_t idx = pos / BLOCK_SECTOR_SIZE;
+      block_sector_t block;
 
-  if(sector_idx_indirect<INDIRECT_INDEX_MAX)
-  {
-    block_sector_t * temp = malloc(sizeof(block_sector_t )*INDIRECT_BLOCK_NUMBER);
-    if(!temp)
-      return -1;
-    cache_read(inode->data.indirect,temp);
-    block_sector_t target_sector = temp[sector_idx_indirect];
-    free(temp);
-    return target_sector;
-  }
+      if (pos >= disk_inode->length)
+        {
+          sectors[i] = PCACHE_NO_SECTOR;
+          continue;
+        }
+      if (idx < DIRECT_INDEX_MAX)
+        {
+          sectors[i] = disk_inode->direct[idx];
+          continue;
+        }
 
-  int sector_idx_double = (sector_idx_indirect - INDIRECT_BLOCK_NUMBER)/POINTER_PER_SECTOR;
-  int double_ofs = (sector_idx_indirect - INDIRECT_BLOCK_NUMBER)%POINTER_PER_SECTOR;
-
-  block_sector_t * temp = malloc(sizeof(block_sector_t )*POINTER_PER_SECTOR);
-  if(!temp)
-    return -1;
-  cache_read(inode->data.double_indirect,temp);
-  int target_double_sector = temp[sector_idx_double];
-  cache_read(target_double_sector,temp);
-  block_sector_t target_sector = temp[double_ofs];
-  free(temp);
-  return target_sector;
+      idx -= DIRECT_BLOCK_NUMBER;
+      if (idx < INDIRECT_INDEX_MAX)
+        block = disk_inode->indirect;
+      else
+        {
+          idx -= INDIRECT_BLOCK_NUMBER;
+          if (outer == PCACHE_NO_SECTOR)
+            {
+              outer = disk_inode->double_indirect;
+              cache_read (outer, buf->outer);
+            }
+          block = buf->outer[idx / POINTER_PER_SECTOR];
+          idx %= POINTER_PER_SECTOR;
+        }
+      if (block != inner)
+        {
+          inner = block;
+          cache_read (inner, buf->inner);
+        }
+      sectors[i] = buf->inner[idx];
+    }
 }
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Protects open_inodes and the open_cnt of every open inode. */
+static struct lock open_inodes_lock;
+
+/* Signaled when a closing inode leaves open_inodes. */
+static struct condition inode_closed;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_closed);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -92,6 +122,7 @@ bool
 inode_create (block_sector_t inode_disk_sector, off_t length,int is_dir)
 {
   struct inode_disk *disk_inode = NULL;
+  struct sector_buf *buf;
   bool success = false;
 
   ASSERT (length >= 0);
@@ -101,7 +132,8 @@ inode_create (block_sector_t inode_disk_sector, off_t length,int is_dir)
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  buf = malloc (sizeof *buf);
+  if (disk_inode != NULL && buf != NULL)
   {
     disk_inode->length = 0;
     disk_inode->magic= INODE_MAGIC;
@@ -109,10 +141,12 @@ inode_create (block_sector_t inode_disk_sector, off_t length,int is_dir)
     if(inode_extend(disk_inode,length))
     {
       success = true;
+      write_pages (inode_disk_sector, disk_inode, NULL, length, 0, 0, buf);
       cache_write ( inode_disk_sector, disk_inode);
     }    
-    free(disk_inode);
   }
+  free(disk_inode);
+  free(buf);
   return success;
 }
 
@@ -125,14 +159,25 @@ inode_open (block_sector_t sector)
   struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
+  lock_acquire (&open_inodes_lock);
+
+  /* Check whether this inode is already open.  If its last opener
+     is still writing it back, wait until it is gone and look
+     again, so that the new content is read. */
+ retry:
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
     {
       inode = list_entry (e, struct inode, elem);
+      if (inode->sector == sector && inode->closing)
+        {
+          cond_wait (&inode_closed, &open_inodes_lock);
+          goto retry;
+        }
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
@@ -140,15 +185,26 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
+  /* Initialize.  The inode is read while still holding the list
+     lock so that nobody else sees it half-initialized. */
   list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->dirty = false;
+  inode->closing = false;
+  inode->dir_free_ofs = 0;
+  inode->dir_compact = false;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->dir_lock);
   cache_read ( inode->sector, &inode->data);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -157,10 +213,26 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt (struct inode *inode)
+{
+  int open_cnt;
+
+  lock_acquire (&open_inodes_lock);
+  open_cnt = inode->open_cnt;
+  lock_release (&open_inodes_lock);
+  return open_cnt;
+}
+
 /* Returns INODE's inode number. */
 block_sector_t
 inode_get_inumber (const struct inode *inode)
@@ -168,9 +240,10 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Closes INODE.
+   If this was the last reference to INODE, writes it back to disk
+   if it is dirty and frees its memory.
+   If INODE was also a removed inode, frees its blocks instead. */
 void
 inode_close (struct inode *inode) 
 {
@@ -178,21 +251,65 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
+      /* Write back before leaving the list, so that a concurrent
+         inode_open() of the same sector reads the new content.
+         The write may wait for the disk, so it is done with the
+         list lock released.  Nobody else can use the inode any
+         more, and inode_open() waits for it while it is marked
+         closing. */
+      if (inode->dirty && !inode->removed)
+        {
+          inode->closing = true;
+          lock_release (&open_inodes_lock);
+          cache_write (inode->sector, &inode->data);
+          lock_acquire (&open_inodes_lock);
+          cond_broadcast (&inode_closed, &open_inodes_lock);
+        }
+
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
+      lock_release (&open_inodes_lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          pcache_truncate (inode->sector, 0);
           free_map_release (inode->sector, 1);
           inode_disk_remove(inode);
         }
 
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
+}
+
+/* Writes every dirty open inode back to the buffer cache. */
+void
+inode_flush_all (void)
+{
+  struct list_elem *e;
+
+  lock_acquire (&open_inodes_lock);
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e))
+    {
+      struct inode *inode = list_entry (e, struct inode, elem);
+      /* Its last close is writing it back. */
+      if (inode->closing)
+        continue;
+      rwlock_acquire_write (&inode->rwlock);
+      if (inode->dirty && !inode->removed)
+        cache_write (inode->sector, &inode->data);
+      inode->dirty = false;
+      rwlock_release_write (&inode->rwlock);
+    }
+  lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -212,127 +329,235 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  struct sector_buf *buf = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      /* Page to read, starting byte offset within page. */
+      size_t index = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      block_sector_t sectors[PCACHE_SECTORS];
+      struct pcache_page *page;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
+      /* Bytes left in inode, bytes left in page, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int page_left = PGSIZE - page_ofs;
+      int min_left = inode_left < page_left ? inode_left : page_left;
 
-      /* Number of bytes to actually copy out of this sector. */
+      /* Number of bytes to actually copy out of this page. */
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* The sectors of the page are only looked up on a miss. */
+      page = pcache_lookup (inode->sector, index);
+      if (page == NULL)
         {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          cache_read (sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          if (buf == NULL)
+            buf = malloc (sizeof *buf);
+          if (buf == NULL)
+            break;
+          page_sectors (&inode->data, index, sectors, buf);
+          page = pcache_get (inode->sector, index, sectors, PCACHE_ALL, 0);
         }
+      memcpy (buffer + bytes_read, page->data + page_ofs, chunk_size);
+      pcache_put (page, 0);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
+  free (buf);
 
   return bytes_read;
 }
 
+/* Starts bringing the pages that hold bytes OFFSET through
+   OFFSET + SIZE - 1 of INODE into the page cache without
+   waiting for them.  Bytes past end of file are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  struct sector_buf *buf = NULL;
+
+  rwlock_acquire_read (&inode->rwlock);
+  off_t end = offset + size;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, PGSIZE); offset < end; offset += PGSIZE)
+    {
+      block_sector_t sectors[PCACHE_SECTORS];
+      if (pcache_contains (inode->sector, offset / PGSIZE))
+        continue;
+      if (buf == NULL)
+        buf = malloc (sizeof *buf);
+      if (buf == NULL)
+        break;
+      page_sectors (&inode->data, offset / PGSIZE, sectors, buf);
+      pcache_prefetch (inode->sector, offset / PGSIZE, sectors);
+    }
+  rwlock_release_read (&inode->rwlock);
+  free (buf);
+}
+
+/* Returns true if the pages that hold bytes OFFSET through
+   OFFSET + SIZE - 1 of INODE are all in the page cache, so that
+   reading them does not wait for the disk.  Bytes past end of
+   file are ignored. */
+bool
+inode_is_cached (struct inode *inode, off_t offset, off_t size)
+{
+  bool cached = true;
+
+  rwlock_acquire_read (&inode->rwlock);
+  off_t end = offset + size;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, PGSIZE); cached && offset < end;
+       offset += PGSIZE)
+    cached = pcache_contains (inode->sector, offset / PGSIZE);
+  rwlock_release_read (&inode->rwlock);
+  return cached;
+}
+
+/* Returns the page cache page that holds the PGSIZE bytes of
+   INODE at OFFSET, which must be page-aligned, for mapping into
+   user processes.  The page stays in the cache until it is
+   released with pcache_unmap().  Returns a null pointer if the
+   page extends past end of file, if too many pages are mapped
+   already, or if memory allocation fails.  The caller must keep
+   INODE from being written while the page is mapped. */
+struct pcache_page *
+inode_map_page (struct inode *inode, off_t offset)
+{
+  struct pcache_page *page = NULL;
+  struct sector_buf *buf;
+
+  ASSERT (offset % PGSIZE == 0);
+
+  buf = malloc (sizeof *buf);
+  if (buf == NULL)
+    return NULL;
+  rwlock_acquire_read (&inode->rwlock);
+  if (offset + PGSIZE <= inode_length (inode))
+    {
+      block_sector_t sectors[PCACHE_SECTORS];
+      page_sectors (&inode->data, offset / PGSIZE, sectors, buf);
+      page = pcache_map (inode->sector, offset / PGSIZE, sectors);
+    }
+  rwlock_release_read (&inode->rwlock);
+  free (buf);
+  return page;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the inode cannot be extended or writes are
+   denied.  Extending a file fills any gap between its old end and
+   OFFSET with zeros. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-  int origin_size = size;
+  off_t old_length;
+  struct sector_buf *buf;
+
+  /* Allocated up front, so that running out of memory cannot
+     leave the file extended over sectors that were never
+     written. */
+  buf = malloc (sizeof *buf);
+  if (buf == NULL)
+    return 0;
 
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      free (buf);
+      return 0;
+    }
 
+  old_length = inode->data.length;
   if(offset+size-1>=inode->data.length)
   {
     bool success = inode_extend(&inode->data,offset+size);
     if(!success)
+    {
+      rwlock_release_write (&inode->rwlock);
+      free (buf);
       return 0;
-    cache_write(inode->sector,&inode->data);
+    }
+    // written back on last close or inode_flush_all()
+    inode->dirty = true;
   }
 
-  while (size > 0) 
-    {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+  if (offset > old_length)
+    write_pages (inode->sector, &inode->data, NULL, offset - old_length,
+                 old_length, old_length, buf);
+  if (size > 0)
+    write_pages (inode->sector, &inode->data, buffer, size, offset,
+                 old_length, buf);
+  rwlock_release_write (&inode->rwlock);
+  free (buf);
+  return size > 0 ? size : 0;
+}
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+/* Writes SIZE bytes from BUFFER, or zeros if BUFFER is null, into
+   the page cache pages of the file whose inode is at INODE_SECTOR
+   and whose on-disk inode is DISK_INODE, starting at OFFSET.  The
+   file must already extend past the bytes written.  Sectors that
+   start at or past OLD_LENGTH have been allocated since the file
+   was OLD_LENGTH bytes long, so they are not read from disk.  BUF
+   is scratch space for page_sectors(). */
+static void
+write_pages (block_sector_t inode_sector, const struct inode_disk *disk_inode,
+             const uint8_t *buffer, off_t size, off_t offset,
+             off_t old_length, struct sector_buf *buf)
+{
+  while (size > 0)
+    {
+      /* Page to write, starting byte offset within page. */
+      size_t index = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int page_left = PGSIZE - page_ofs;
+      int chunk_size = size < page_left ? size : page_left;
+      block_sector_t sectors[PCACHE_SECTORS];
+      uint8_t need = 0, fresh = 0, dirty = 0;
+      struct pcache_page *page;
+
+      /* A sector that is only partly overwritten has to be read
+         first, unless it is new. */
+      for (int i = 0; i < PCACHE_SECTORS; i++)
         {
-          /* Write full sector directly to disk. */
-          cache_write (sector_idx, buffer + bytes_written);
+          off_t start = (off_t) index * PGSIZE + i * BLOCK_SECTOR_SIZE;
+          off_t end = start + BLOCK_SECTOR_SIZE;
+          if (end <= offset || start >= offset + chunk_size)
+            continue;
+          dirty |= 1 << i;
+          if (start >= old_length)
+            fresh |= 1 << i;
+          else if (start < offset || end > offset + chunk_size)
+            need |= 1 << i;
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write ( sector_idx, bounce);
+      page_sectors (disk_inode, index, sectors, buf);
+      page = pcache_get (inode_sector, index, sectors, need, fresh);
+      if (buffer != NULL)
+        {
+          memcpy (page->data + page_ofs, buffer, chunk_size);
+          buffer += chunk_size;
         }
+      else
+        memset (page->data + page_ofs, 0, chunk_size);
+      pcache_put (page, dirty);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
-      bytes_written += chunk_size;
     }
-  free (bounce);
-  return bytes_written;
 }
 
 /* Disables writes to INODE.
@@ -340,8 +565,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -350,12 +577,16 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.
+   Takes no lock: the length is a single aligned word, and
+   inode_read_at() calls this while holding INODE's lock. */
 off_t
 inode_length (const struct inode *inode)
 {
@@ -393,7 +624,8 @@ get_block_num(int sectors_num,int* direct_num,int*indirect_num,int * double_indi
   }
 }
 
-/* Get a free block and store the index in to PTR */
+/* Get a free block and store the index in to PTR.  The block is
+   filled through the page cache by whoever extends the file */
 static bool
 inode_get_data_block(block_sector_t * ptr)
 {
@@ -402,7 +634,8 @@ inode_get_data_block(block_sector_t * ptr)
     *ptr = 0;
     return false;
   }
-  cache_write(*ptr,zeros);
+  // the block may have held metadata before
+  cache_discard(*ptr);
   return true;
 }
 
@@ -432,10 +665,13 @@ inode_extend_directs(struct inode_disk* disk_inode, int except_length)
 static bool
 inode_extend_indirect(block_sector_t * ptr, int except_length)
 {
-  static block_sector_t buffer[POINTER_PER_SECTOR];
-
   if(except_length<=0)
     return true;
+
+  // not static, since inodes may now be extended concurrently
+  block_sector_t * buffer = malloc(BLOCK_SECTOR_SIZE);
+  if(!buffer)
+    return false;
   
   if(*ptr == 0)
   {
@@ -453,14 +689,15 @@ inode_extend_indirect(block_sector_t * ptr, int except_length)
       except_length--;
     }
     if(!success)
-      return false;
+      break;
     if(except_length == 0)
     {
       cache_write(*ptr,buffer);
-      return true;
+      break;
     }
   }
-  return true;
+  free(buffer);
+  return success;
 }
 
 /* Caclualte the remain blocks of the given indirect ptr */
@@ -469,12 +706,15 @@ get_free_blocks_indirect(block_sector_t * ptr)
 {
   if (*ptr==0)
     return INDIRECT_BLOCK_NUMBER;
-  static block_sector_t buffer[POINTER_PER_SECTOR];
+  block_sector_t * buffer = malloc(BLOCK_SECTOR_SIZE);
+  if(!buffer)
+    return 0;
   cache_read(*ptr,buffer);
   int res = 0;
   for(int i=0;i<POINTER_PER_SECTOR;i++)
     if(buffer[i]==0)
       res++;
+  free(buffer);
   return res;
 }
 
@@ -485,7 +725,9 @@ inode_extend_double(block_sector_t * ptr, int except_length)
   if(except_length<=0)
     return true;
   
-  static block_sector_t double_buffer[POINTER_PER_SECTOR];
+  block_sector_t * double_buffer = malloc(BLOCK_SECTOR_SIZE);
+  if(!double_buffer)
+    return false;
   if(*ptr ==0)
   {
     free_map_allocate(1,ptr);
@@ -499,14 +741,15 @@ inode_extend_double(block_sector_t * ptr, int except_length)
     success = inode_extend_indirect(double_buffer+i,except_blocks);
     except_length-=except_blocks;
     if(!success)
-      return false;
+      break;
     if(except_length == 0)
     {
       cache_write(*ptr,double_buffer);
-      return true;
+      break;
     }
   }
-  return true;
+  free(double_buffer);
+  return success;
 }
 
 /* Extend the given file which is recorded in the DISK_INODE to LENGTH,and update info in DISK_INODE */
@@ -551,6 +794,103 @@ inode_extend(struct inode_disk * disk_inode,int length)
   return success;
 }
 
+/* Releases the data pointers LO...HI-1 of the pointer block at
+   *PTR, using BUFFER as scratch space.  If LO is 0, the pointer
+   block itself is released as well and *PTR is cleared. */
+static void
+release_pointers(block_sector_t * ptr,size_t lo,size_t hi,block_sector_t * buffer)
+{
+  cache_read(*ptr,buffer);
+  for(size_t i=lo;i<hi;i++)
+  {
+    free_map_release(buffer[i],1);
+    buffer[i] = 0;
+  }
+  if(lo == 0)
+  {
+    free_map_release(*ptr,1);
+    *ptr = 0;
+  }
+  else
+    cache_write(*ptr,buffer);
+}
+
+/* Shrinks INODE to LENGTH bytes, releasing every data sector past
+   the new end of file.  Cleared pointers let inode_extend() grow
+   the inode again later. */
+void
+inode_shrink(struct inode * inode,off_t length)
+{
+  struct inode_disk * disk_inode = &inode->data;
+
+  // scratch blocks, allocated before anything is released
+  block_sector_t * buffer = malloc(BLOCK_SECTOR_SIZE);
+  block_sector_t * double_buffer = malloc(BLOCK_SECTOR_SIZE);
+  if(buffer == NULL || double_buffer == NULL)
+  {
+    free(buffer);
+    free(double_buffer);
+    return;
+  }
+
+  rwlock_acquire_write(&inode->rwlock);
+  if(length >= disk_inode->length)
+  {
+    rwlock_release_write(&inode->rwlock);
+    free(buffer);
+    free(double_buffer);
+    return;
+  }
+  size_t keep = bytes_to_sectors(length);
+  size_t old = bytes_to_sectors(disk_inode->length);
+  pcache_truncate(inode->sector,length);
+
+  // release direct blocks
+  for(size_t i=keep;i<old && i<DIRECT_BLOCK_NUMBER;i++)
+  {
+    free_map_release(disk_inode->direct[i],1);
+    disk_inode->direct[i] = 0;
+  }
+
+  if(old > DIRECT_BLOCK_NUMBER)
+  {
+    // release indirect blocks
+    size_t lo = keep > DIRECT_BLOCK_NUMBER ? keep-DIRECT_BLOCK_NUMBER : 0;
+    size_t hi = min(old-DIRECT_BLOCK_NUMBER,INDIRECT_BLOCK_NUMBER);
+    if(lo < hi)
+      release_pointers(&disk_inode->indirect,lo,hi,buffer);
+
+    // release double indirect blocks
+    if(old > DIRECT_BLOCK_NUMBER+INDIRECT_BLOCK_NUMBER)
+    {
+      size_t double_lo = keep > DIRECT_BLOCK_NUMBER+INDIRECT_BLOCK_NUMBER
+                         ? keep-DIRECT_BLOCK_NUMBER-INDIRECT_BLOCK_NUMBER : 0;
+      size_t double_hi = old-DIRECT_BLOCK_NUMBER-INDIRECT_BLOCK_NUMBER;
+      cache_read(disk_inode->double_indirect,double_buffer);
+      for(size_t i=double_lo/POINTER_PER_SECTOR;i<=(double_hi-1)/POINTER_PER_SECTOR;i++)
+      {
+        size_t first = i*POINTER_PER_SECTOR;
+        size_t ptr_lo = double_lo > first ? double_lo-first : 0;
+        size_t ptr_hi = min(double_hi-first,POINTER_PER_SECTOR);
+        release_pointers(double_buffer+i,ptr_lo,ptr_hi,buffer);
+      }
+      if(double_lo == 0)
+      {
+        free_map_release(disk_inode->double_indirect,1);
+        disk_inode->double_indirect = 0;
+      }
+      else
+        cache_write(disk_inode->double_indirect,double_buffer);
+    }
+  }
+
+  disk_inode->length = length;
+  inode->dirty = true;
+  rwlock_release_write(&inode->rwlock);
+  free(buffer);
+  free(double_buffer);
+}
+
 static void
 inode_disk_remove(struct inode * inode)
 {
@@ -5,9 +5,11 @@
 #include "filesys/off_t.h"
 #include "devices/block.h"
 #include <list.h>
+#include "threads/synch.h"
 
 
 struct bitmap;
+struct pcache_page;
 
 #define META_DATA_NUM 5
 #define DIRECT_BLOCK_NUMBER ((BLOCK_SECTOR_SIZE-META_DATA_NUM*sizeof(block_sector_t))/sizeof(block_sector_t))
@@ -45,7 +47,13 @@ struct inode
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool dirty;                         /* DATA not yet written back. */
+    bool closing;                       /* Last close writing DATA back. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Protects data and length. */
+    struct lock dir_lock;               /* Directory: protects entries. */
+    off_t dir_free_ofs;                 /* Directory: no free entry before this. */
+    bool dir_compact;                   /* Directory: trailing entries freed. */
     struct inode_disk data;             /* Inode content. */
   };
 
@@ -53,13 +61,19 @@ void inode_init (void);
 bool inode_create (block_sector_t, off_t,int);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
+int inode_open_cnt (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_flush_all (void);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
+bool inode_is_cached (struct inode *, off_t offset, off_t size);
+struct pcache_page *inode_map_page (struct inode *, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_shrink (struct inode *, off_t length);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,466 @@
+#include "filesys/page-cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+/* The page cache holds the data of files, a page at a time, for
+   inode_read_at() and inode_write_at().  File pages that processes
+   map read-only are mapped straight from here, so the data is in
+   memory only once however it is used.  Inodes and index blocks
+   stay in the sector cache in cache.c.
+
+   Every page remembers the disk sector of each of its parts, so a
+   dirty page can be written back after its file is closed.  The
+   parts are kept up to date by the inode module, which passes them
+   to pcache_get() on every write and on every read that
+   pcache_lookup() cannot serve, and calls pcache_truncate() before
+   it gives sectors back to the free map. */
+
+#define PCACHE_SIZE 32
+/* Maximum number of pages mapped into user processes, so that
+   the rest of the cache is left for reads and writes */
+#define PCACHE_MAP_MAX (PCACHE_SIZE/2)
+/* Maximum number of pages being read ahead at once */
+#define PCACHE_PREFETCH_MAX (PCACHE_SIZE/4)
+
+static struct pcache_page pages[PCACHE_SIZE];
+static struct lock pcache_lock;
+/* Broadcast whenever a page finishes its disk I/O or is unpinned */
+static struct condition pcache_idle;
+/* Number of pages mapped by pcache_map() */
+static int mapped_cnt;
+/* Number of pages with read-ahead requests in flight */
+static int prefetch_cnt;
+
+static struct pcache_page * page_find(block_sector_t inumber,size_t index);
+static struct pcache_page * get_page(block_sector_t inumber,size_t index);
+static struct pcache_page * evict_page(void);
+static struct pcache_page * free_page(void);
+static void load(struct pcache_page * page,uint8_t missing);
+static void write_back(struct pcache_page * page);
+static block_done_func prefetch_done;
+
+/* Init page cache */
+void
+pcache_init(void)
+{
+  uint8_t * data = palloc_get_multiple(PAL_ASSERT,PCACHE_SIZE);
+  for(int i=0;i<PCACHE_SIZE;i++)
+  {
+    pages[i].valid = false;
+    pages[i].busy = false;
+    pages[i].pin_cnt = 0;
+    pages[i].last_accessed_time = 0;
+    pages[i].data = data+i*PGSIZE;
+  }
+  lock_init(&pcache_lock);
+  cond_init(&pcache_idle);
+  mapped_cnt = prefetch_cnt = 0;
+}
+
+/* Return page INDEX of the file with inode INUMBER, pinned, whose
+   parts are on disk at SECTORS.  The parts in NEED are read from
+   disk if they are not in the page yet.  The parts in FRESH have
+   just been allocated, so they are filled with zeros instead, like
+   the parts past end of file.
+   Release the page with pcache_put() */
+struct pcache_page *
+pcache_get(block_sector_t inumber,size_t index,const block_sector_t * sectors,
+           uint8_t need,uint8_t fresh)
+{
+  lock_acquire(&pcache_lock);
+  struct pcache_page * page = get_page(inumber,index);
+  page->pin_cnt++;
+  page->last_accessed_time = timer_ticks();
+  memcpy(page->sectors,sectors,sizeof page->sectors);
+  for(int i=0;i<PCACHE_SECTORS;i++)
+  {
+    uint8_t bit = 1<<i;
+    if(!(page->loaded & bit)
+       && ((fresh & bit) || sectors[i] == PCACHE_NO_SECTOR))
+    {
+      memset(page->data+i*BLOCK_SECTOR_SIZE,0,BLOCK_SECTOR_SIZE);
+      page->loaded |= bit;
+    }
+  }
+  uint8_t missing = need & ~page->loaded;
+  if(missing)
+    load(page,missing);
+  lock_release(&pcache_lock);
+  return page;
+}
+
+/* Unpin PAGE, marking the parts in DIRTY as modified */
+void
+pcache_put(struct pcache_page * page,uint8_t dirty)
+{
+  lock_acquire(&pcache_lock);
+  ASSERT(page->pin_cnt > 0);
+  page->dirty |= dirty;
+  if(--page->pin_cnt == 0)
+    cond_broadcast(&pcache_idle,&pcache_lock);
+  lock_release(&pcache_lock);
+}
+
+/* Like pcache_get() with every part needed, for a page that is to
+   be mapped into user processes.  The page stays pinned until
+   pcache_unmap().  Return NULL if too many pages are mapped
+   already */
+struct pcache_page *
+pcache_map(block_sector_t inumber,size_t index,const block_sector_t * sectors)
+{
+  struct pcache_page * page = pcache_get(inumber,index,sectors,PCACHE_ALL,0);
+  lock_acquire(&pcache_lock);
+  bool full = mapped_cnt >= PCACHE_MAP_MAX;
+  if(!full)
+    mapped_cnt++;
+  lock_release(&pcache_lock);
+  if(full)
+  {
+    pcache_put(page,0);
+    return NULL;
+  }
+  return page;
+}
+
+/* Undo pcache_map() */
+void
+pcache_unmap(struct pcache_page * page)
+{
+  lock_acquire(&pcache_lock);
+  mapped_cnt--;
+  lock_release(&pcache_lock);
+  pcache_put(page,0);
+}
+
+/* Start reading page INDEX of the file with inode INUMBER, whose
+   parts are on disk at SECTORS, into the cache in the background.
+   Does nothing if the page is cached already, or if it could only
+   be brought in by writing another page back */
+void
+pcache_prefetch(block_sector_t inumber,size_t index,
+                const block_sector_t * sectors)
+{
+  lock_acquire(&pcache_lock);
+  struct pcache_page * page = NULL;
+  if(page_find(inumber,index) == NULL && prefetch_cnt < PCACHE_PREFETCH_MAX)
+    page = free_page();
+  if(page == NULL)
+  {
+    lock_release(&pcache_lock);
+    return;
+  }
+
+  page->valid = true;
+  page->inumber = inumber;
+  page->index = index;
+  page->loaded = PCACHE_ALL;
+  page->dirty = 0;
+  page->last_accessed_time = timer_ticks();
+  memcpy(page->sectors,sectors,sizeof page->sectors);
+  page->busy = true;
+  page->reads = 0;
+  prefetch_cnt++;
+  // one request per run of consecutive sectors
+  for(int i=0;i<PCACHE_SECTORS;)
+  {
+    if(sectors[i] == PCACHE_NO_SECTOR)
+    {
+      memset(page->data+i*BLOCK_SECTOR_SIZE,0,BLOCK_SECTOR_SIZE);
+      i++;
+      continue;
+    }
+    int cnt = 1;
+    while(i+cnt<PCACHE_SECTORS && sectors[i+cnt] == sectors[i]+cnt)
+      cnt++;
+    page->reads++;
+    block_request_init(&page->req[i],false,sectors[i],cnt,
+                       page->data+i*BLOCK_SECTOR_SIZE,prefetch_done,page);
+    block_submit(fs_device,&page->req[i]);
+    i += cnt;
+  }
+  // the whole page is past end of file
+  if(page->reads == 0)
+  {
+    page->busy = false;
+    prefetch_cnt--;
+  }
+  lock_release(&pcache_lock);
+}
+
+/* Called by the disk's I/O thread when a read-ahead request of the
+   page AUX finishes */
+static void
+prefetch_done(struct block_request * req UNUSED,void * aux)
+{
+  struct pcache_page * page = aux;
+
+  lock_acquire(&pcache_lock);
+  if(--page->reads == 0)
+  {
+    page->busy = false;
+    prefetch_cnt--;
+    cond_broadcast(&pcache_idle,&pcache_lock);
+  }
+  lock_release(&pcache_lock);
+}
+
+/* Return true if page INDEX of the file with inode INUMBER is
+   entirely in the cache and not being read or written, so that
+   reading it does not wait for the disk */
+bool
+pcache_contains(block_sector_t inumber,size_t index)
+{
+  lock_acquire(&pcache_lock);
+  struct pcache_page * page = page_find(inumber,index);
+  bool res = page != NULL && !page->busy;
+  for(int i=0;res && i<PCACHE_SECTORS;i++)
+    res = (page->loaded & 1<<i) || page->sectors[i] == PCACHE_NO_SECTOR;
+  lock_release(&pcache_lock);
+  return res;
+}
+
+/* Return page INDEX of the file with inode INUMBER, pinned, if it
+   is entirely in the cache and not being read or written, or NULL
+   otherwise.  Unlike pcache_get(), the disk sectors of the page
+   need not be known.  Release the page with pcache_put() */
+struct pcache_page *
+pcache_lookup(block_sector_t inumber,size_t index)
+{
+  lock_acquire(&pcache_lock);
+  struct pcache_page * page = page_find(inumber,index);
+  if(page != NULL && !page->busy && page->loaded == PCACHE_ALL)
+  {
+    page->pin_cnt++;
+    page->last_accessed_time = timer_ticks();
+  }
+  else
+    page = NULL;
+  lock_release(&pcache_lock);
+  return page;
+}
+
+/* Drop the parts of the pages of the file with inode INUMBER that
+   lie past its first LENGTH bytes, without writing them back, as
+   the file is being shrunk to LENGTH or, if LENGTH is 0, removed.
+   Must be called before the sectors are released, so that they
+   are not written to after they have been reused */
+void
+pcache_truncate(block_sector_t inumber,off_t length)
+{
+  lock_acquire(&pcache_lock);
+  for(int i=0;i<PCACHE_SIZE;i++)
+  {
+    struct pcache_page * page = &pages[i];
+    while(page->valid && page->inumber == inumber && page->busy)
+      cond_wait(&pcache_idle,&pcache_lock);
+    if(!page->valid || page->inumber != inumber)
+      continue;
+    // nobody can be using the pages of a file that is being freed
+    ASSERT(length > 0 || page->pin_cnt == 0);
+
+    for(int j=0;j<PCACHE_SECTORS;j++)
+    {
+      off_t start = (off_t) page->index*PGSIZE+j*BLOCK_SECTOR_SIZE;
+      if(start >= length)
+      {
+        page->sectors[j] = PCACHE_NO_SECTOR;
+        page->loaded &= ~(1<<j);
+        page->dirty &= ~(1<<j);
+      }
+    }
+    if((off_t) page->index*PGSIZE >= length && page->pin_cnt == 0)
+      page->valid = false;
+  }
+  lock_release(&pcache_lock);
+}
+
+/* Return page INDEX of the file with inode INUMBER when it is not
+   busy.  On a miss a page is assigned to it, with no part loaded.
+   Must be called with pcache_lock held.  The lock may be released
+   meanwhile */
+static struct pcache_page *
+get_page(block_sector_t inumber,size_t index)
+{
+  for(;;)
+  {
+    struct pcache_page * page = page_find(inumber,index);
+    if(page != NULL)
+    {
+      if(!page->busy)
+        return page;
+      // wait for the I/O on this page, then look again
+      cond_wait(&pcache_idle,&pcache_lock);
+      continue;
+    }
+
+    page = evict_page();
+    // the lock was released while evicting, so look again
+    if(page == NULL)
+      continue;
+
+    page->valid = true;
+    page->inumber = inumber;
+    page->index = index;
+    page->loaded = 0;
+    page->dirty = 0;
+    return page;
+  }
+}
+
+/* Return a page that holds nothing or the least recently used
+   clean page that is not pinned or busy, or NULL if there is
+   none.  Must be called with pcache_lock held */
+static struct pcache_page *
+free_page(void)
+{
+  struct pcache_page * victim = NULL;
+  for(int i=0;i<PCACHE_SIZE;i++)
+  {
+    struct pcache_page * page = &pages[i];
+    if(page->busy || page->pin_cnt > 0)
+      continue;
+    if(!page->valid)
+      return page;
+    if(page->dirty == 0
+       && (victim == NULL
+           || page->last_accessed_time < victim->last_accessed_time))
+      victim = page;
+  }
+  if(victim != NULL)
+    victim->valid = false;
+  return victim;
+}
+
+/* Return a free page, evicting the least recently used page that
+   is not pinned or busy if necessary.
+   If the victim is dirty, it is written back with pcache_lock
+   released and NULL is returned, so the caller must look up its
+   page again.  NULL is also returned after waiting if every page
+   is in use */
+static struct pcache_page *
+evict_page(void)
+{
+  struct pcache_page * victim = NULL;
+  for(int i=0;i<PCACHE_SIZE;i++)
+  {
+    struct pcache_page * page = &pages[i];
+    if(page->busy || page->pin_cnt > 0)
+      continue;
+    if(!page->valid)
+      return page;
+    if(victim == NULL || page->last_accessed_time < victim->last_accessed_time)
+      victim = page;
+  }
+
+  if(victim == NULL)
+  {
+    cond_wait(&pcache_idle,&pcache_lock);
+    return NULL;
+  }
+  if(victim->dirty)
+  {
+    write_back(victim);
+    return NULL;
+  }
+  victim->valid = false;
+  return victim;
+}
+
+/* Read the parts MISSING of PAGE, which the caller has pinned,
+   from disk.  Must be called with pcache_lock held.  The lock is
+   released during disk I/O */
+static void
+load(struct pcache_page * page,uint8_t missing)
+{
+  block_sector_t sectors[PCACHE_SECTORS];
+
+  memcpy(sectors,page->sectors,sizeof sectors);
+  page->busy = true;
+  lock_release(&pcache_lock);
+  for(int i=0;i<PCACHE_SECTORS;)
+  {
+    if(!(missing & 1<<i))
+    {
+      i++;
+      continue;
+    }
+    int cnt = 1;
+    while(i+cnt<PCACHE_SECTORS && (missing & 1<<(i+cnt))
+          && sectors[i+cnt] == sectors[i]+cnt)
+      cnt++;
+    block_read_multiple(fs_device,sectors[i],cnt,
+                        page->data+i*BLOCK_SECTOR_SIZE);
+    i += cnt;
+  }
+  lock_acquire(&pcache_lock);
+  page->loaded |= missing;
+  page->busy = false;
+  cond_broadcast(&pcache_idle,&pcache_lock);
+}
+
+/* Write the dirty parts of PAGE back to disk, each run of parts
+   that are next to each other on disk with one command.
+   Must be called with pcache_lock held.  The lock is released
+   during disk I/O */
+static void
+write_back(struct pcache_page * page)
+{
+  block_sector_t sectors[PCACHE_SECTORS];
+  uint8_t dirty = page->dirty;
+
+  memcpy(sectors,page->sectors,sizeof sectors);
+  page->busy = true;
+  page->dirty = 0;
+  lock_release(&pcache_lock);
+  for(int i=0;i<PCACHE_SECTORS;)
+  {
+    if(!(dirty & 1<<i))
+    {
+      i++;
+      continue;
+    }
+    int cnt = 1;
+    while(i+cnt<PCACHE_SECTORS && (dirty & 1<<(i+cnt))
+          && sectors[i+cnt] == sectors[i]+cnt)
+      cnt++;
+    block_write_multiple(fs_device,sectors[i],cnt,
+                         page->data+i*BLOCK_SECTOR_SIZE);
+    i += cnt;
+  }
+  lock_acquire(&pcache_lock);
+  page->busy = false;
+  cond_broadcast(&pcache_idle,&pcache_lock);
+}
+
+/* Find the page INDEX of the file with inode INUMBER, return NULL
+   if it is not cached */
+static struct pcache_page *
+page_find(block_sector_t inumber,size_t index)
+{
+  for(int i=0;i<PCACHE_SIZE;i++)
+  {
+    if(pages[i].valid && pages[i].inumber == inumber
+       && pages[i].index == index)
+      return &pages[i];
+  }
+  return NULL;
+}
+
+/* Flush all dirty pages into disk */
+void
+pcache_done(void)
+{
+  lock_acquire(&pcache_lock);
+  for(int i=0;i<PCACHE_SIZE;i++)
+  {
+    while(pages[i].busy)
+      cond_wait(&pcache_idle,&pcache_lock);
+    if(pages[i].valid && pages[i].dirty)
+      write_back(&pages[i]);
+  }
+  lock_release(&pcache_lock);
+}
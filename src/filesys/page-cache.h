@@ -0,0 +1,60 @@
+#ifndef FILESYS_PAGE_CACHE_H
+#define FILESYS_PAGE_CACHE_H
+#include "devices/block.h"
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/vaddr.h"
+
+/* Sectors in one page of a file */
+#define PCACHE_SECTORS (PGSIZE/BLOCK_SECTOR_SIZE)
+/* Mask with a bit set for every sector of a page */
+#define PCACHE_ALL ((uint8_t) ((1<<PCACHE_SECTORS)-1))
+/* Disk sector of a part of a page that lies past end of file */
+#define PCACHE_NO_SECTOR ((block_sector_t) -1)
+
+/* A page of file data, identified by the sector of the file's
+   inode and the page's index in the file.  Bit I of the sector
+   masks stands for the sector at byte I*BLOCK_SECTOR_SIZE of the
+   page. */
+struct pcache_page
+  {
+    /* True if the page holds part of a file */
+    bool valid;
+    /* True while the page is being read from or written to disk */
+    bool busy;
+    /* Inode sector of the file */
+    block_sector_t inumber;
+    /* Index of the page in the file */
+    size_t index;
+    /* Disk sector of each part of the page, or PCACHE_NO_SECTOR */
+    block_sector_t sectors[PCACHE_SECTORS];
+    /* Sectors whose data is in the page */
+    uint8_t loaded;
+    /* Sectors that have to be written back */
+    uint8_t dirty;
+    /* Number of users, a pinned page is never evicted */
+    int pin_cnt;
+    /* Last accessed time */
+    uint32_t last_accessed_time;
+    /* Read-ahead requests still in flight */
+    int reads;
+    struct block_request req[PCACHE_SECTORS];
+    /* PGSIZE bytes of data */
+    uint8_t * data;
+  };
+
+void pcache_init(void);
+struct pcache_page * pcache_get(block_sector_t inumber,size_t index,
+                                const block_sector_t * sectors,
+                                uint8_t need,uint8_t fresh);
+void pcache_put(struct pcache_page * page,uint8_t dirty);
+struct pcache_page * pcache_map(block_sector_t inumber,size_t index,
+                                const block_sector_t * sectors);
+void pcache_unmap(struct pcache_page * page);
+void pcache_prefetch(block_sector_t inumber,size_t index,
+                     const block_sector_t * sectors);
+struct pcache_page * pcache_lookup(block_sector_t inumber,size_t index);
+bool pcache_contains(block_sector_t inumber,size_t index);
+void pcache_truncate(block_sector_t inumber,off_t length);
+void pcache_done(void);
+#endif
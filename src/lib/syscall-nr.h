@@ -28,7 +28,17 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_GETDENTS,               /* Reads many directory entries at once. */
+
+    /* Instrumentation. */
+    SYS_BLOCKSTATS,             /* Reads a block device's statistics. */
+    SYS_TICKS,                  /* Reads the timer ticks since boot. */
+
+    /* Project 3 extensions, after the rest so that their numbers
+       stay the same. */
+    SYS_FORK,                   /* Duplicate this process. */
+    SYS_LARGEPAGE               /* Back a 4 MB region with a large page. */
   };
 
 #endif /* lib/syscall-nr.h */
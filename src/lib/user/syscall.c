@@ -153,6 +153,18 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+pid_t
+fork (void)
+{
+  return syscall0 (SYS_FORK);
+}
+
+bool
+largepage (void *addr)
+{
+  return syscall1 (SYS_LARGEPAGE, addr);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -182,3 +194,21 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+getdents (int fd, struct dirent *entries, unsigned cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, cnt);
+}
+
+bool
+blockstats (const char *device, struct blockstats *stats)
+{
+  return syscall2 (SYS_BLOCKSTATS, device, stats);
+}
+
+int
+ticks (void)
+{
+  return syscall0 (SYS_TICKS);
+}
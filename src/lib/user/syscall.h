@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -15,6 +16,34 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* Directory entry filled in by getdents(). */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* Is a directory? */
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated file name. */
+  };
+
+/* Number of buckets in a blockstats() latency histogram. */
+#define BLOCKSTATS_BUCKETS 32
+
+/* Block device statistics filled in by blockstats().
+   Histogram bucket I counts requests that took 2**I to
+   2**(I+1) - 1 CPU cycles; the last bucket also counts all slower
+   ones.  Only whole devices, not partitions, gather latency and
+   driver figures. */
+struct blockstats
+  {
+    uint64_t read_cnt;                          /* Sectors read. */
+    uint64_t write_cnt;                         /* Sectors written. */
+    uint32_t read_hist[BLOCKSTATS_BUCKETS];     /* Read latencies. */
+    uint32_t write_hist[BLOCKSTATS_BUCKETS];    /* Write latencies. */
+    uint32_t in_flight;                         /* Requests pending now. */
+    uint32_t max_in_flight;                     /* Most ever pending. */
+    uint64_t lock_cycles;                       /* Driver held its lock. */
+    uint64_t intr_cycles;                       /* Driver awaited interrupts. */
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -37,6 +66,8 @@ void close (int fd);
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+pid_t fork (void);
+bool largepage (void *addr);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -44,5 +75,10 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int getdents (int fd, struct dirent *, unsigned cnt);
+
+/* Instrumentation. */
+bool blockstats (const char *device, struct blockstats *);
+int ticks (void);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,32 @@
+/* Creates a few entries in a directory and reads them back with
+   getdents(), using a buffer too small to hold all of them. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct dirent entries[2];
+  int fd;
+  int cnt;
+  int i;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 0), "create \"a/b\"");
+  CHECK (create ("a/c", 0), "create \"a/c\"");
+  CHECK (mkdir ("a/d"), "mkdir \"a/d\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+
+  while ((cnt = getdents (fd, entries, 2)) > 0)
+    {
+      msg ("getdents returned %d entries", cnt);
+      for (i = 0; i < cnt; i++)
+        msg ("%s: %s", entries[i].name,
+             entries[i].is_dir ? "directory" : "file");
+    }
+  CHECK (cnt == 0, "getdents at end of directory");
+  CHECK (getdents (fd, entries, 2) == 0, "getdents again");
+  close (fd);
+}
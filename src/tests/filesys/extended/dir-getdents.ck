@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "a"
+(dir-getdents) create "a/b"
+(dir-getdents) create "a/c"
+(dir-getdents) mkdir "a/d"
+(dir-getdents) open "a"
+(dir-getdents) getdents returned 2 entries
+(dir-getdents) b: file
+(dir-getdents) c: file
+(dir-getdents) getdents returned 1 entries
+(dir-getdents) d: directory
+(dir-getdents) getdents at end of directory
+(dir-getdents) getdents again
+(dir-getdents) end
+EOF
+pass;
@@ -0,0 +1,64 @@
+/* Fills 1 MB of memory, forks, and checks that the child sees
+   the parent's data, that the child's writes to it do not show
+   through to the parent, and that the child gets its own copy of
+   each open file, starting at the parent's position. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+#define CHUNK 10
+
+static char buf[SIZE];
+
+/* Checks that every byte of BUF is VALUE. */
+static void
+check_buf (char value)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail ("byte %zu is %02hhx instead of %02hhx", i, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  char chunk[CHUNK];
+  int handle;
+  pid_t child;
+  int status;
+
+  memset (buf, 0x5a, sizeof buf);
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (handle, chunk, CHUNK) == CHUNK, "read \"sample.txt\"");
+
+  child = fork ();
+  if (child == 0)
+    {
+      msg ("child: check memory");
+      check_buf (0x5a);
+      msg ("child: write memory");
+      memset (buf, 0xa5, sizeof buf);
+      check_buf (0xa5);
+      CHECK (read (handle, chunk, CHUNK) == CHUNK
+             && !memcmp (chunk, sample + CHUNK, CHUNK),
+             "child: read \"sample.txt\" from parent's position");
+      exit (81);
+    }
+  if (child == -1)
+    fail ("fork");
+
+  /* No output until the child is done, so the order is fixed. */
+  status = wait (child);
+  CHECK (status == 81, "wait for child");
+  msg ("check memory");
+  check_buf (0x5a);
+  CHECK (read (handle, chunk, CHUNK) == CHUNK
+         && !memcmp (chunk, sample + CHUNK, CHUNK),
+         "read \"sample.txt\" from own position");
+}
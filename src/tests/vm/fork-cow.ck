@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) open "sample.txt"
+(fork-cow) read "sample.txt"
+(fork-cow) child: check memory
+(fork-cow) child: write memory
+(fork-cow) child: read "sample.txt" from parent's position
+fork-cow: exit(81)
+(fork-cow) wait for child
+(fork-cow) check memory
+(fork-cow) read "sample.txt" from own position
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
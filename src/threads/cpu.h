@@ -0,0 +1,51 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Returns the number of CPU cycles since reset, from the
+   time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  /* See [IA32-v2b] "RDTSC". */
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Executes CPUID for LEAF and stores the resulting EAX, EBX, ECX
+   and EDX in the corresponding arguments.  Every CPU that has
+   RDTSC also has CPUID. */
+static inline void
+cpuid (uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+       uint32_t *edx)
+{
+  /* See [IA32-v2a] "CPUID". */
+  asm volatile ("cpuid"
+                : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                : "a" (leaf), "c" (0));
+}
+
+/* Feature flags returned in EDX by CPUID leaf 1. */
+#define CPUID_EDX_PSE (1 << 3)  /* 4 MB pages. */
+#define CPUID_EDX_PGE (1 << 13) /* Global pages. */
+
+/* Returns true if CPUID leaf 1 sets all of FEATURES in EDX. */
+static inline bool
+cpu_has_features (uint32_t features)
+{
+  uint32_t eax, ebx, ecx, edx;
+  cpuid (0, &eax, &ebx, &ecx, &edx);
+  if (eax < 1)
+    return false;
+  cpuid (1, &eax, &ebx, &ecx, &edx);
+  return (edx & features) == features;
+}
+
+/* CR4 flags.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR4_PSE 0x00000010      /* Page Size Extensions. */
+#define CR4_PGE 0x00000080      /* Page Global Enable. */
+
+#endif /* threads/cpu.h */
@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -34,9 +35,18 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/page-cache.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -53,6 +63,13 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -stripe: Comma-separated names of the block devices to stripe
+   into the "stripe0" device. */
+static char *stripe_bdev_names;
+
+/* -ramdisk: Size of the RAM disk in kB, 0 for none. */
+static size_t ramdisk_size;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -124,11 +141,24 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  if (ramdisk_size > 0)
+    ramdisk_init (ramdisk_size);
+  if (stripe_bdev_names != NULL)
+    stripe_init (stripe_bdev_names);
   locate_block_devices ();
   cache_init();
+  pcache_init ();
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init ();
+  page_init ();
+  share_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -155,13 +185,29 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports it, each 4 MB region of RAM that holds no
+   kernel text is mapped with a single large page, which takes
+   one TLB entry instead of 1,024.  Kernel text stays in 4 kB
+   pages so that it can be read-only, and so does a partial
+   region at the end of RAM.  Only kernel virtual addresses are
+   mapped this way; user mappings always go through page
+   tables.
+
+   Kernel mappings are the same in every page directory, so they
+   are also made global if the CPU supports it.  Their TLB
+   entries then survive the CR3 loads of context switches. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool pse = cpu_has_features (CPUID_EDX_PSE);
+  bool pge = cpu_has_features (CPUID_EDX_PGE);
+  uint32_t global = pge ? PTE_G : 0;
+  uint32_t cr4;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -173,21 +219,43 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
+  /* Large pages must be enabled in CR4 before a page directory
+     that uses them is loaded.  See [IA32-v3a] 3.7.3 "Mixing 4-KByte
+     and 4-MByte Pages". */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (pse)
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 |= CR4_PSE));
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* From now on, the TLB keeps the entries of kernel pages when
+     CR3 is loaded.  See [IA32-v3a] 3.12 "Translation Lookaside
+     Buffers (TLBs)". */
+  if (pge)
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE));
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -249,9 +317,25 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-stripe"))
+        stripe_bdev_names = value;
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          int size = value != NULL ? atoi (value) : 0;
+          if (size <= 0)
+            PANIC ("-ramdisk needs a positive size in kB (use -h for help)");
+          ramdisk_size = size;
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-fault-around"))
+        {
+          int pages = value != NULL ? atoi (value) : 0;
+          if (pages < 1 || pages > 64)
+            PANIC ("-fault-around needs 1 to 64 pages (use -h for help)");
+          fault_around_pages = pages;
+        }
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
@@ -375,8 +459,14 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs into block device stripe0.\n"
+          "  -ramdisk=SIZE      Create SIZE kB RAM disk ram0, SIZE > 0; use\n"
+          "                     with -filesys=ram0 -f to make it the file\n"
+          "                     system.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -fault-around=N    Bring in up to N pages per file page fault,\n"
+          "                     1 <= N <= 64.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
@@ -414,6 +504,8 @@ locate_block_device (enum block_type role, const char *name)
       block = block_get_by_name (name);
       if (block == NULL)
         PANIC ("No such block device \"%s\"", name);
+      if (stripe_has_member (block))
+        PANIC ("Block device \"%s\" is part of a striped device", name);
     }
   else
     {
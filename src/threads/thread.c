@@ -14,6 +14,8 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#include "filesys/directory.h"
+#include "filesys/file.h"
 #include "malloc.h"
 
 /* Random value for struct thread's `magic' member.
@@ -38,8 +40,6 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
-static struct lock file_lock;
-
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -95,7 +95,6 @@ thread_init (void)
   lock_init (&tid_lock);
   list_init (&ready_list);
   list_init (&all_list);
-  lock_init(&file_lock);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -319,14 +318,12 @@ thread_exit (void)
   {
     struct thread_file * temp = list_entry(i,struct thread_file,file_elem);
     i = list_next(i);
-    thread_acquire_file_lock();
     if(temp->opened)
     {
       file_close(temp->file);
       if(temp->is_dir)
         dir_close(temp->dir);
     }
-    thread_release_file_lock();
     free(temp);
   }
   dir_close(thread_current()->cwd);
@@ -520,6 +517,11 @@ init_thread (struct thread *t, const char *name, int priority)
   t->child_run = 0;
   // init thread's exe_file
   t->exe_file = NULL;
+#ifdef VM
+  // init list for memory-mapped files
+  list_init(&t->mappings);
+  t->next_mapid = 0;
+#endif
 
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -636,20 +638,6 @@ allocate_tid (void)
   return tid;
 }
 
-/* Acquire the file lock */
-void
-thread_acquire_file_lock()
-{
-  lock_acquire(&file_lock);
-}
-
-/* Release the file lock */
-void
-thread_release_file_lock()
-{
-  lock_release(&file_lock);
-}
-
 /* Add a file into the current thread's file list and return the file descriptor */
 int
 thread_add_file(struct file * file,struct dir * dir ,bool is_dir)
@@ -665,6 +653,36 @@ thread_add_file(struct file * file,struct dir * dir ,bool is_dir)
   return temp->fd;
 }
 
+/* Duplicate all open files of PARENT into the current thread under the same
+   file descriptors, for fork(). Every copy has its own position, which starts
+   where the parent's is. Return false if memory allocation fails */
+bool
+thread_dup_files(struct thread * parent)
+{
+  struct thread * t = thread_current();
+  for(struct list_elem* i =list_begin(&parent->owned_files);i!=list_end(&parent->owned_files);i=list_next(i))
+  {
+    struct thread_file * temp = list_entry(i,struct thread_file,file_elem);
+    if(!temp->opened)
+      continue;
+    struct thread_file * copy = malloc(sizeof(struct thread_file));
+    if(!copy)
+      return false;
+    copy->fd = temp->fd;
+    copy->is_dir = temp->is_dir;
+    copy->file = file_reopen(temp->file);
+    copy->dir = temp->is_dir ? dir_reopen(temp->dir) : NULL;
+    copy->opened = 1;
+    // closed by thread_exit() even if only one of them was opened
+    list_push_back(&t->owned_files,&copy->file_elem);
+    if(!copy->file || (temp->is_dir && !copy->dir))
+      return false;
+    file_seek(copy->file,file_tell(temp->file));
+  }
+  t->next_fd = parent->next_fd;
+  return true;
+}
+
 /* Close the fiel according to the file descriptor */
 void
 thread_close_file(int fd)
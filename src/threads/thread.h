@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
@@ -151,6 +152,14 @@ struct thread
    struct file * exe_file;
    /* Current working directory */
    struct dir * cwd;
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    void *user_esp;                     /* User esp on kernel entry. */
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+#endif
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -191,8 +200,7 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-void thread_acquire_file_lock();
-void thread_release_file_lock();
 int thread_add_file(struct file * file,struct dir * dir ,bool is_dir);
+bool thread_dup_files(struct thread * parent);
 void thread_close_file(int fd);
 #endif /* threads/thread.h */
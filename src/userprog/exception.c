@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "threads/vaddr.h"
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -150,6 +154,18 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* A page of the process that has not been brought in yet, the
+     stack growing, or the first write to a page that shares the
+     zero page.  A fault in the kernel is measured against the esp
+     that the last system call saved. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if ((not_present || write) && is_user_vaddr (fault_addr)
+      && page_load_around (fault_addr, write))
+    return;
+#endif
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -7,7 +7,7 @@
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -80,6 +80,11 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
         return NULL;
     }
 
+  /* Kernel memory may be mapped by large pages, which have no
+     page table.  See paging_init(). */
+  if (*pde & PTE_PS)
+    return NULL;
+
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
   return &pt[pt_no (vaddr)];
@@ -126,8 +131,15 @@ void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
 {
   uint32_t *pte;
+  uint32_t pde;
 
   ASSERT (is_user_vaddr (uaddr));
+
+  /* A large page has no page table. */
+  pde = pd[pd_no (uaddr)];
+  if ((pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+    return ((uint8_t *) ptov (pde & ~(uint32_t) (PTSPAN - 1))
+            + ((uintptr_t) uaddr & (PTSPAN - 1)));
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
@@ -136,6 +148,56 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
     return NULL;
 }
 
+/* Maps the 4 MB of user virtual memory at UPAGE in page
+   directory PD to the physically contiguous frames at KPAGE
+   with a single large page, read/write if WRITABLE is true and
+   read-only otherwise.  UPAGE and KPAGE must be 4 MB aligned, and
+   no page in the region may be mapped.  The page table that
+   covered the region, if any, is freed.  Requires CR4_PSE. */
+void
+pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                        bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT ((uintptr_t) upage % PTSPAN == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (*pde != 0)
+    {
+      uint32_t *pt = pde_get_pt (*pde);
+      size_t i;
+
+      for (i = 0; i < PGSIZE / sizeof *pt; i++)
+        ASSERT ((pt[i] & PTE_P) == 0);
+      palloc_free_page (pt);
+    }
+  *pde = pde_create_large_user (kpage, writable);
+
+  /* The CPU may have cached the old directory entry. */
+  invalidate_page (pd, upage);
+}
+
+/* Removes the large page that maps the 4 MB at UPAGE from page
+   directory PD.  The region need not be mapped. */
+void
+pagedir_clear_large_page (uint32_t *pd, void *upage)
+{
+  uint32_t *pde;
+
+  ASSERT ((uintptr_t) upage % PTSPAN == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pde = pd + pd_no (upage);
+  if (*pde & PTE_PS)
+    {
+      *pde = 0;
+      invalidate_page (pd, upage);
+    }
+}
+
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
@@ -152,7 +214,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -180,7 +242,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,18 +271,21 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is there already.  Loading it flushes
+   every TLB entry but those of kernel pages, which are global. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (active_pd () == pd)
+    return;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -245,19 +310,21 @@ active_pd (void)
 
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry for the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VADDR if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.) */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vaddr) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Unlike re-activating PD, this leaves the rest of the TLB
+         alone.  See [IA32-v2a] "INVLPG" and [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
     } 
 }
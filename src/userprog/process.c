@@ -14,11 +14,19 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+#endif
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static void pass_argument(void ** esp,char * args);
 
@@ -105,6 +113,88 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Starts a new thread running a copy of the current user
+   process, which must be in a system call.  The copy returns 0
+   from the system call, while the current process gets the new
+   process's thread id.  Returns TID_ERROR if the thread cannot
+   be created or the copy cannot be set up. */
+tid_t
+process_fork (void)
+{
+  /* Entering the kernel from user mode switches to the top of
+     the thread's kernel stack (see tss_update()), where the
+     interrupt stubs then build the frame. */
+  const struct intr_frame *parent_if
+    = (struct intr_frame *) ((uint8_t *) thread_current () + PGSIZE) - 1;
+  struct intr_frame *if_;
+  tid_t tid;
+
+  /* The child copies the frame onto its own stack. */
+  if_ = malloc (sizeof *if_);
+  if (if_ == NULL)
+    return TID_ERROR;
+  *if_ = *parent_if;
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork, if_);
+  // wait for the child to copy us, so that nothing changes meanwhile
+  if(tid != TID_ERROR)
+    sema_down(&thread_current()->child_load);
+  else
+    free (if_);
+  return tid != TID_ERROR && thread_current()->child_run? tid:TID_ERROR;
+}
+
+/* A thread function that makes the current thread a copy of its
+   parent process, which is blocked in process_fork(), and starts
+   it running where the parent entered the kernel.  The address
+   space is shared copy-on-write.  Open files and memory mappings
+   are duplicated. */
+static void
+start_fork (void *if_)
+{
+  struct intr_frame frame = *(struct intr_frame *) if_;
+  struct thread *t = thread_current ();
+  struct thread *parent = t->parent_thread;
+  bool success = false;
+
+  free (if_);
+
+  /* Same order as load(). */
+  if (!page_table_init ())
+    goto done;
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    {
+      page_table_destroy ();
+      goto done;
+    }
+  process_activate ();
+
+  t->exe_file = file_reopen (parent->exe_file);
+  if (t->exe_file == NULL)
+    goto done;
+  file_deny_write (t->exe_file);
+  t->user_esp = parent->user_esp;
+
+  success = (page_table_fork (parent, t->exe_file)
+             && mmap_fork (parent)
+             && thread_dup_files (parent));
+
+ done:
+  // tell the parent whether success
+  parent->child_run = success;
+  sema_up (&parent->child_load);
+  if (!success)
+    thread_exit ();
+
+  /* Return 0 from fork() in the child. */
+  frame.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&frame) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -155,6 +245,16 @@ process_exit (void)
   uint32_t *pd;
   // print the information of the process when exit
   printf ("%s: exit(%d)\n",cur->name,cur->child_info->exit_status);
+#ifdef VM
+  /* Free the pages while the page directory still maps them.
+     Unmapping writes the mapped files back first. */
+  if (cur->pagedir != NULL)
+    {
+      mmap_unmap_all ();
+      page_table_destroy ();
+    }
+#endif
+  // The pages of the executable are gone, so it may be written again
   file_close(cur->exe_file);
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -182,8 +282,14 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  Kernel threads only use
+     kernel mappings, which every page directory has, so they run
+     on whichever one is active.  Switching from a process to a
+     kernel thread and back then costs no TLB flush.  An exiting
+     process activates the initial page directory itself before
+     it destroys its own. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -273,10 +379,22 @@ load (const char *file_name, void (**eip) (void), void **esp)
   bool success = false;
   int i;
 
+#ifdef VM
+  /* Allocate supplemental page table.  It is destroyed together
+     with the page directory in process_exit(). */
+  if (!page_table_init ())
+    goto done;
+#endif
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
-    goto done;
+    {
+#ifdef VM
+      page_table_destroy ();
+#endif
+      goto done;
+    }
   process_activate ();
 
   /* Open executable file. */
@@ -378,7 +496,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -447,6 +567,25 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Only record where each page comes from.  The pages are read
+     in by the page fault handler when they are first touched. */
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+
+      /* Advance. */
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -482,6 +621,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -489,10 +629,16 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
-  uint8_t *kpage;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#ifdef VM
+  /* The arguments are pushed right away, so bring the page in. */
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  success = page_add_zero (upage, true) && page_load (upage, true);
+  if (success)
+    *esp = PHYS_BASE;
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
@@ -501,9 +647,11 @@ setup_stack (void **esp)
       else
         palloc_free_page (kpage);
     }
+#endif
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -523,6 +671,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 static void 
 pass_argument(void ** esp,char * args){
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include <limits.h>
 #include <stdio.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
@@ -10,9 +11,17 @@
 #include "filesys/file.h"
 #include "filesys/directory.h"
 #include "filesys/inode.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 static bool check_ptr(const void * ptr);
+static bool check_buffer(const void * buffer, unsigned size, bool writable);
+static void unpin_buffer(const void * buffer, unsigned size);
 static bool check_esp(const void * esp_);
 static struct thread_file * get_thread_file(int fd);
 static struct file * get_file(int fd);
@@ -27,6 +36,10 @@ static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
   void * esp = f->esp;
+#ifdef VM
+  // Stack growth during the syscall is checked against the user's esp
+  thread_current()->user_esp = esp;
+#endif
   // check the address space of whole arguments
   if(!check_esp(esp))
   {
@@ -91,6 +104,29 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_CHDIR:
       f->eax = chdir(*(const char **)argv[0]);
       break;
+    case SYS_GETDENTS:
+      f->eax = getdents(*(int *)argv[0],*(struct dir_record **)argv[1],*(unsigned*)argv[2]);
+      break;
+    case SYS_BLOCKSTATS:
+      f->eax = blockstats(*(const char **)argv[0],*(struct block_stats **)argv[1]);
+      break;
+    case SYS_TICKS:
+      f->eax = ticks();
+      break;
+#ifdef VM
+    case SYS_MMAP:
+      f->eax = mmap(*(int *)argv[0],*(void **)argv[1]);
+      break;
+    case SYS_MUNMAP:
+      munmap(*(mapid_t *)argv[0]);
+      break;
+    case SYS_FORK:
+      f->eax = fork();
+      break;
+    case SYS_LARGEPAGE:
+      f->eax = largepage(*(void **)argv[0]);
+      break;
+#endif
     default:
       exit(-1);
       NOT_REACHED();
@@ -103,11 +139,59 @@ static bool
 check_ptr(const void * ptr)
 {
   struct thread * t = thread_current();
-  if(!is_user_vaddr(ptr) || !ptr || !pagedir_get_page(t->pagedir,ptr))
-    return false;  
+  if(!is_user_vaddr(ptr) || !ptr)
+    return false;
+  if(pagedir_get_page(t->pagedir,ptr))
+    return true;
+#ifdef VM
+  // The page may not have been brought in yet
+  return page_load(ptr,false);
+#else
+  return false;
+#endif
+}
+
+/* Check the validation of every page of a buffer. If WRITABLE is true, the
+   buffer must also be writable. Under VM, every page is brought in and pinned,
+   because the file system copies to and from the buffer while holding its
+   locks, so unpin_buffer() must be called once the buffer is no longer used.
+   Nothing is left pinned if the check fails, and the caller must not exit()
+   while the buffer is pinned */
+static bool
+check_buffer(const void * buffer, unsigned size, bool writable UNUSED)
+{
+  const uint8_t * start = buffer;
+  const uint8_t * end = start + size;
+  if(!check_ptr(start) || !check_ptr(end-1) || end < start)
+    return false;
+  for(const uint8_t * i = pg_round_down(start);i<end;i+=PGSIZE){
+#ifdef VM
+    if(!page_pin(i,writable))
+    {
+      // unpin the pages before this one
+      if(i > start)
+        unpin_buffer(start,i-start);
+      return false;
+    }
+#else
+    if(!check_ptr(i<start ? start : i))
+      return false;
+#endif
+  }
   return true;
 }
 
+/* Allow the pages of a buffer checked by check_buffer() to be evicted again */
+static void
+unpin_buffer(const void * buffer UNUSED, unsigned size UNUSED)
+{
+#ifdef VM
+  const uint8_t * start = buffer;
+  for(const uint8_t * i = pg_round_down(start);i<start+size;i+=PGSIZE)
+    page_unpin(i);
+#endif
+}
+
 /* Check the validation of the given esp and the address of the arguments  */
 static bool
 check_esp(const void * esp)
@@ -122,6 +206,10 @@ check_esp(const void * esp)
   switch(sys_num)
   {
     case SYS_HALT:
+    case SYS_TICKS:
+#ifdef VM
+    case SYS_FORK:
+#endif
       break;
     case SYS_EXIT:
     case SYS_EXEC:
@@ -135,17 +223,26 @@ check_esp(const void * esp)
     case SYS_MKDIR:
     case SYS_ISDIR:
     case SYS_INUMBER:
+#ifdef VM
+    case SYS_MUNMAP:
+    case SYS_LARGEPAGE:
+#endif
       if(!check_ptr(esp) || !check_ptr(esp+3))
         success = false;
       break;
     case SYS_SEEK:
     case SYS_CREATE:
     case SYS_READDIR:
+    case SYS_BLOCKSTATS:
+#ifdef VM
+    case SYS_MMAP:
+#endif
       if(!check_ptr(esp) || !check_ptr(esp+7))
         success = false;
       break;
     case SYS_READ:
     case SYS_WRITE:
+    case SYS_GETDENTS:
       if(!check_ptr(esp) || !check_ptr(esp+11))
         success = false;
       break;
@@ -206,9 +303,7 @@ bool create (const char *file, unsigned initial_size)
   /* If the string FILE is not valid, exit(-1) */
   if(!check_str(file))
     exit(-1);
-  thread_acquire_file_lock();
   bool success =  filesys_create (file,initial_size,false);
-  thread_release_file_lock();
   return success;
 }
 
@@ -218,9 +313,7 @@ bool remove (const char *file)
   /* If the string FILE is not valid, exit(-1) */
   if(!check_str(file))
     exit(-1);
-  thread_acquire_file_lock();
   bool success =  filesys_remove (file);
-  thread_release_file_lock();
   return success;
 }
 
@@ -228,9 +321,7 @@ int open (const char *file)
 {
   if(!check_str(file))
     exit(-1);
-  thread_acquire_file_lock();
   struct file * temp = filesys_open(file);
-  thread_release_file_lock();
   if(temp){
     struct inode * inode = file_get_inode(temp);
     bool is_dir = inode->data.is_dir;
@@ -248,61 +339,63 @@ int open (const char *file)
 /* Return file size according to the file descriptior*/
 int filesize (int fd)
 {
-  thread_acquire_file_lock();
   int size = file_length(get_file(fd));
-  thread_release_file_lock();
   return size;
 }
 
 /* SysCall read */
 int read (int fd, void *buffer, unsigned length)
 {
+  // Look up the file before pinning the buffer. If no such file, exit
+  struct file* file = NULL;
+  if(fd != 0)
+  {
+    file = get_file(fd);
+    if(!file)
+      exit(-1);
+  }
   // Check the validation of buffer
-  if(!check_ptr(buffer) || !check_ptr(buffer+length-1))
+  if(!check_buffer(buffer,length,true))
     exit(-1);
 
+  int size = 0;
   // Read from the STDIN
   if(fd == 0)
-  {
-    return input_getc();
-  }
-  struct file* file = get_file(fd);
-  // If no such file, exit
-  if(!file)
-    exit(-1);
-  thread_acquire_file_lock();
-  int size = 0;
-  size = file_read(file,buffer,length);
-  thread_release_file_lock();  
+    size = input_getc();
+  else
+    size = file_read(file,buffer,length);
+  unpin_buffer(buffer,length);
   return size;
 }
 
 /* SysCall write */
 int write (int fd, const void *buffer, unsigned length)
 {
+  // Look up the file before pinning the buffer. If no such file, exit
+  struct thread_file * temp = NULL;
+  if(fd != 1)
+  {
+    temp = get_thread_file(fd);
+    if(!temp || (!temp->is_dir && !temp->file))
+      exit(-1);
+  }
   // Check the validation of buffer
-  if(!check_ptr(buffer) || !check_ptr(buffer+length-1))
+  if(!check_buffer(buffer,length,false))
     exit(-1);
+
+  int size;
   // write to the STDOUT
   if(fd == 1)
   {
     putbuf((const char *)buffer,length);
-    return length;
+    size = length;
   }
+  else if(temp->is_dir)
+    size = -1;
   else
-  {
-    struct thread_file * temp = get_thread_file(fd);
-    if(!temp)
-      exit(-1);
-    if(temp->is_dir)
-      return -1;
-    if(!temp->file)
-      exit(-1);
-    thread_acquire_file_lock();
-    int size = file_write(temp->file,buffer,length);
-    thread_release_file_lock();
-    return size;
-  }
+    size = file_write(temp->file,buffer,length);
+  unpin_buffer(buffer,length);
+  return size;
 }
 
 /* SysCall seek */
@@ -311,18 +404,14 @@ void seek (int fd, unsigned position)
   struct file * file =  get_file(fd);
   if(!file)
     exit(-1);
-  thread_acquire_file_lock();
   file_seek(file,position);
-  thread_release_file_lock();
 }
 
 /* SysCall tell */
 unsigned tell (int fd)
 {
   struct file * file =  get_file(fd);
-  thread_acquire_file_lock();
   unsigned pos = file_tell(file);
-  thread_release_file_lock();
   return pos;
 }
 
@@ -334,12 +423,10 @@ void close (int fd)
     exit(-1);
   if(thread_file->opened == 0)
     exit(-1);
-  thread_acquire_file_lock();
   file_close(thread_file->file);
   if(thread_file->is_dir)
     dir_close(thread_file->dir);
   thread_close_file(fd);
-  thread_release_file_lock();
 }
 
 /*Changes the current working directory of the process to dir, 
@@ -348,9 +435,7 @@ bool chdir (const char *dir)
 {
   if(!check_str(dir))
     exit(-1);
-  thread_acquire_file_lock();
   bool success = filesys_cd(dir);
-  thread_release_file_lock();
   return success;
 }
 
@@ -360,9 +445,7 @@ bool mkdir (const char *dir)
 {
   if(!check_str(dir))
     exit(-1);
-  thread_acquire_file_lock();
   bool success = filesys_create(dir,0,1);
-  thread_release_file_lock();
 
   return success;
 }
@@ -377,14 +460,102 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1])
     return false;
   if(!temp->is_dir)
     return false;
-  
-  thread_acquire_file_lock();
+  // Check the validation of buffer
+  if(!check_buffer(name,READDIR_MAX_LEN + 1,true))
+    exit(-1);
+
   int res = dir_readdir(temp->dir,name);
-  thread_release_file_lock();
+  unpin_buffer(name,READDIR_MAX_LEN + 1);
+
+  return res;
+}
+
+/*Reads up to cnt directory entries from file descriptor fd, which must represent a directory,
+into entries. Returns the number of entries stored, 0 if no entries are left,
+or -1 if fd does not represent a directory.*/
+int getdents (int fd, struct dir_record *entries, unsigned cnt)
+{
+  if(cnt == 0)
+    return 0;
+  // The size of the buffer must not wrap around
+  if(cnt > UINT_MAX / sizeof *entries)
+    exit(-1);
+  unsigned size = cnt * sizeof *entries;
+  // Check the validation of buffer
+  if(!check_buffer(entries,size,true))
+    exit(-1);
+  struct thread_file * temp = get_thread_file(fd);
+  int res = -1;
+  if(temp && temp->is_dir)
+    res = dir_readdir_multiple(temp->dir,entries,cnt);
+  unpin_buffer(entries,size);
 
   return res;
 }
 
+/*Copies the statistics of the block device named device into stats.
+Returns false if there is no such device.*/
+bool blockstats (const char *device, struct block_stats *stats)
+{
+  if(!check_str(device))
+    exit(-1);
+  if(!check_buffer(stats,sizeof *stats,true))
+    exit(-1);
+
+  struct block_stats temp;
+  bool success = block_get_stats(device,&temp);
+  if(success)
+    *stats = temp;
+  unpin_buffer(stats,sizeof *stats);
+  return success;
+}
+
+/*Returns the number of timer ticks since the OS booted.*/
+int ticks (void)
+{
+  return timer_ticks();
+}
+
+#ifdef VM
+/*Maps the file open as fd into the process's virtual address space, starting at addr.
+Returns a mapping ID that uniquely identifies the mapping within the process,
+or -1 on failure.*/
+mapid_t mmap (int fd, void *addr)
+{
+  struct thread_file * temp = get_thread_file(fd);
+  if(!temp || temp->is_dir || !temp->file)
+    return -1;
+  // The mapping must stay valid after the file is closed
+  struct file * file = file_reopen(temp->file);
+  if(!file)
+    return -1;
+  return mmap_map(file,addr);
+}
+
+/*Unmaps the mapping designated by mapping, writing back the pages written by the process.*/
+void munmap (mapid_t mapping)
+{
+  mmap_unmap(mapping);
+}
+
+/*Creates a copy of the current process that shares its memory copy-on-write and
+has its own copy of every open file. Returns the child's pid in the parent, 0 in
+the child, and -1 if the child cannot be created.*/
+pid_t fork (void)
+{
+  return process_fork();
+}
+
+/*Backs the 4 MB aligned region at addr, which must hold only untouched
+zero-filled pages, with a single large page. Its frames are never evicted, so
+the large pages of all processes together may take at most half of user
+memory. Returns false if it cannot, and the region keeps ordinary pages.*/
+bool largepage (void *addr)
+{
+  return page_make_large(addr);
+}
+#endif
+
 /*Returns true if fd represents a directory, false if it represents an ordinary file.*/
 bool isdir (int fd)
 {
@@ -400,9 +571,7 @@ int inumber (int fd)
   struct file * temp = get_file(fd);
   if(!temp)
     return false;
-  thread_acquire_file_lock();
   int res = inode_get_inumber(file_get_inode(temp));
-  thread_release_file_lock();
   return res;
 }
 
@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <debug.h>
 typedef int pid_t;
+typedef int mapid_t;
+
+struct dir_record;
+struct block_stats;
 
 #define READDIR_MAX_LEN 14
 
@@ -28,5 +32,14 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int getdents (int fd, struct dir_record *entries, unsigned cnt);
+
+mapid_t mmap (int fd, void *addr);
+void munmap (mapid_t mapping);
+pid_t fork (void);
+bool largepage (void *addr);
+
+bool blockstats (const char *device, struct block_stats *stats);
+int ticks (void);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,255 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Every frame of the user pool that holds a user page.  When the
+   pool runs out, a frame is taken back from some page chosen by
+   the clock algorithm.
+
+   Lock order: the lock of a page, private or shared, is acquired
+   before FRAME_LOCK.  Eviction holds FRAME_LOCK while it looks
+   for a victim, so it only ever tries the victim's lock. */
+static struct list frames;
+static struct lock frame_lock;
+
+/* Clock hand: the next frame to consider for eviction. */
+static struct list_elem *hand;
+
+/* Most pages that one eviction writes out to swap together. */
+#define EVICT_CLUSTER 8
+
+static void remove_frame (struct frame *);
+static struct frame *evict (struct page *, struct share *);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  lock_init (&frame_lock);
+  hand = list_end (&frames);
+}
+
+/* Obtains a frame for private page P or shared page S, whichever
+   is not null, evicting another page if the user pool is
+   exhausted.  The caller must hold the lock of P or S.  Returns
+   the frame, or a null pointer if no page can be evicted. */
+struct frame *
+frame_alloc (struct page *p, struct share *s)
+{
+  struct frame *f = frame_try_alloc (p, s);
+  return f != NULL ? f : evict (p, s);
+}
+
+/* Like frame_alloc(), but returns a null pointer instead of
+   evicting a page when the user pool is exhausted. */
+struct frame *
+frame_try_alloc (struct page *p, struct share *s)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT ((p != NULL) != (s != NULL));
+  ASSERT (p == NULL || lock_held_by_current_thread (&p->lock));
+  ASSERT (s == NULL || lock_held_by_current_thread (&s->lock));
+
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage == NULL)
+    return NULL;
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  f->page = p;
+  f->share = s;
+  f->pin_cnt = 0;
+
+  lock_acquire (&frame_lock);
+  list_push_back (&frames, &f->elem);
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Makes frame F hold private page P or shared page S, whichever
+   is not null, instead of the page it holds now.  The caller must
+   hold the locks of both pages. */
+void
+frame_set_owner (struct frame *f, struct page *p, struct share *s)
+{
+  ASSERT ((p != NULL) != (s != NULL));
+
+  lock_acquire (&frame_lock);
+  f->page = p;
+  f->share = s;
+  lock_release (&frame_lock);
+}
+
+/* Frees frame F.  The caller must hold the lock of the page in
+   F and have unmapped it everywhere. */
+void
+frame_free (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  remove_frame (f);
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Removes frame F from the frame table.  FRAME_LOCK must be
+   held. */
+static void
+remove_frame (struct frame *f)
+{
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+}
+
+/* Advances the clock hand and returns the frame it passed. */
+static struct frame *
+clock_next (void)
+{
+  struct frame *f;
+
+  if (hand == list_end (&frames))
+    hand = list_begin (&frames);
+  f = list_entry (hand, struct frame, elem);
+  hand = list_next (hand);
+  return f;
+}
+
+/* Advances the clock hand to the next page that can be evicted
+   and returns its frame, or returns a null pointer after
+   MAX_TRIES frames.  A page accessed since the hand last passed
+   it gets a second chance.  The page, private or shared, is
+   unmapped and its lock is held on return.  If SWAP_ONLY, only
+   private pages that have to go to swap are taken.  FRAME_LOCK
+   must be held. */
+static struct frame *
+clock_victim (size_t max_tries, bool swap_only)
+{
+  size_t i;
+
+  for (i = 0; i < max_tries && !list_empty (&frames); i++)
+    {
+      struct frame *f = clock_next ();
+      struct page *q = f->page;
+
+      if (f->share != NULL)
+        {
+          if (!swap_only && share_unmap (f->share))
+            return f;
+          continue;
+        }
+
+      /* The current thread holds the locks of the page it is
+         bringing in and of the pages it is evicting already. */
+      if (lock_held_by_current_thread (&q->lock)
+          || !lock_try_acquire (&q->lock))
+        continue;
+      if (f->pin_cnt > 0)
+        {
+          lock_release (&q->lock);
+          continue;
+        }
+      if (pagedir_is_accessed (q->pagedir, q->upage))
+        {
+          pagedir_set_accessed (q->pagedir, q->upage, false);
+          lock_release (&q->lock);
+          continue;
+        }
+      if ((swap_only && !page_needs_swap (q)) || !page_unmap (q))
+        {
+          lock_release (&q->lock);
+          continue;
+        }
+      return f;
+    }
+  return NULL;
+}
+
+/* Takes a frame away from the page in it and gives it to private
+   page P or shared page S.  Returns a null pointer if every frame
+   is pinned or busy, or if the dirty pages have nowhere to go.
+
+   A page that goes to swap is written out along with up to
+   EVICT_CLUSTER - 1 more such pages that the clock hand finds
+   right after it.  Their slots are allocated one after another,
+   so they are mostly contiguous, and the block layer merges the
+   writes into a few large requests.  The frames of the extra
+   pages go back to the user pool, so the next few page faults do
+   not have to evict anything. */
+static struct frame *
+evict (struct page *p, struct share *s)
+{
+  struct frame *victims[EVICT_CLUSTER];
+  struct page *pages[EVICT_CLUSTER];
+  size_t i, cnt;
+
+  lock_acquire (&frame_lock);
+
+  /* Two full turns clear every accessed bit, so a victim is found
+     by then if there is one at all. */
+  victims[0] = clock_victim (2 * list_size (&frames) + 1, false);
+  if (victims[0] == NULL)
+    {
+      lock_release (&frame_lock);
+      return NULL;
+    }
+  if (victims[0]->share != NULL)
+    {
+      struct share *old = victims[0]->share;
+      victims[0]->page = p;
+      victims[0]->share = s;
+      lock_release (&frame_lock);
+      share_write_out (old, victims[0]);
+      return victims[0];
+    }
+
+  /* Gather more pages to swap out along with the first.  Their
+     frames leave the table, so no one else picks them while they
+     are written out. */
+  pages[0] = victims[0]->page;
+  cnt = 1;
+  if (pages[0]->swap_slot != SWAP_ERROR)
+    while (cnt < EVICT_CLUSTER)
+      {
+        struct frame *f = clock_victim (2 * EVICT_CLUSTER, true);
+        if (f == NULL)
+          break;
+        remove_frame (f);
+        victims[cnt] = f;
+        pages[cnt++] = f->page;
+      }
+
+  /* Hand the first frame over before dropping FRAME_LOCK. */
+  victims[0]->page = p;
+  victims[0]->share = s;
+  lock_release (&frame_lock);
+
+  for (i = 0; i < cnt; i++)
+    page_write_begin (pages[i]);
+  for (i = 0; i < cnt; i++)
+    {
+      page_write_end (pages[i]);
+      lock_release (&pages[i]->lock);
+      if (i > 0)
+        {
+          palloc_free_page (victims[i]->kpage);
+          free (victims[i]);
+        }
+    }
+  return victims[0];
+}
@@ -0,0 +1,29 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "devices/block.h"
+
+struct page;
+struct share;
+
+/* A frame of the user pool that holds a user page.  The page is
+   either private to one process or shared, never both. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Private page in the frame, or NULL. */
+    struct share *share;        /* Shared page in the frame, or NULL. */
+    unsigned pin_cnt;           /* Kept from eviction while nonzero. */
+    struct block_request io;    /* Swap transfer in progress. */
+    struct list_elem elem;      /* Element in the frame table. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, struct share *);
+struct frame *frame_try_alloc (struct page *, struct share *);
+void frame_set_owner (struct frame *, struct page *, struct share *);
+void frame_free (struct frame *);
+
+#endif /* vm/frame.h */
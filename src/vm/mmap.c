@@ -0,0 +1,138 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.  A mapping only adds pages to the
+   supplemental page table; they are read from the file, through
+   the buffer cache, when first touched, and written back to it
+   when they are evicted or unmapped. */
+
+/* Maps FILE at ADDR in the current process, taking ownership of
+   FILE.  Returns the new mapping's identifier, or -1 if ADDR is
+   not page-aligned, FILE is empty, or the pages it would occupy
+   are not all free.  FILE is closed on failure. */
+int
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length = file_length (file);
+  size_t i;
+
+  if (addr == NULL || pg_ofs (addr) != 0 || length == 0)
+    goto fail;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    goto fail;
+  m->file = file;
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  /* The whole range must be unused user memory. */
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      void *upage = (uint8_t *) addr + i * PGSIZE;
+      if (!is_user_vaddr (upage) || page_lookup (upage) != NULL)
+        {
+          free (m);
+          goto fail;
+        }
+    }
+
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      if (!page_add_mapped ((uint8_t *) addr + ofs, file, ofs, read_bytes))
+        {
+          while (i-- > 0)
+            page_remove ((uint8_t *) addr + i * PGSIZE);
+          free (m);
+          goto fail;
+        }
+    }
+
+  m->id = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+
+ fail:
+  file_close (file);
+  return -1;
+}
+
+/* Removes mapping M, writing its dirty pages back to the file. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove ((uint8_t *) m->base + i * PGSIZE);
+  list_remove (&m->elem);
+  file_close (m->file);
+  free (m);
+}
+
+/* Removes the current process's mapping with identifier ID, if
+   there is one. */
+void
+mmap_unmap (int id)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        {
+          unmap (m);
+          return;
+        }
+    }
+}
+
+/* Gives the current process, a child of PARENT made by fork(),
+   its own mapping of the same file at the same address, with the
+   same identifier, for each of PARENT's mappings.  PARENT's pages
+   have been written back by page_table_fork(), so both processes
+   see the same data.  Returns true if successful, false if memory
+   allocation fails. */
+bool
+mmap_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->mappings); e != list_end (&parent->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      struct file *file = file_reopen (m->file);
+
+      /* mmap_map() hands out the next identifier. */
+      t->next_mapid = m->id;
+      if (file == NULL || mmap_map (file, m->base) == -1)
+        return false;
+    }
+  t->next_mapid = parent->next_mapid;
+  return true;
+}
+
+/* Removes all of the current process's mappings. */
+void
+mmap_unmap_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings))
+    unmap (list_entry (list_front (&t->mappings), struct mapping, elem));
+}
@@ -0,0 +1,26 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct file;
+struct thread;
+
+/* A file mapped into a process's address space by mmap(). */
+struct mapping
+  {
+    int id;                     /* Mapping identifier. */
+    struct file *file;          /* Mapped file, owned by the mapping. */
+    void *base;                 /* First page of the mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+    struct list_elem elem;      /* Element in thread's mapping list. */
+  };
+
+int mmap_map (struct file *, void *addr);
+void mmap_unmap (int id);
+void mmap_unmap_all (void);
+bool mmap_fork (struct thread *parent);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,854 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "devices/block.h"
+#include "filesys/inode.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/cpu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Pages of a process are only recorded here when it is loaded;
+   their contents are read in by page_load() on the first access,
+   so a program pays only for the pages it actually touches.  A
+   page that is evicted later is brought back the same way, from
+   its file or from swap. */
+
+/* Maximum size of a user stack. */
+#define STACK_MAX (8 * 1024 * 1024)
+
+/* Bytes below the stack pointer that may be accessed.  PUSHA
+   writes 32 bytes below esp before it moves it. */
+#define STACK_SLOP 32
+
+/* Pages in a large page. */
+#define LARGE_PAGE_PAGES (PTSPAN / PGSIZE)
+
+/* Number of pages in the aligned window around a faulting file
+   page that page_load_around() brings in along with it.  1 turns
+   fault-around off.  Windows much larger than the default crowd
+   out the rest of the page cache.  Set with the -fault-around=N
+   option, where N is 1 to 64. */
+size_t fault_around_pages = 4;
+
+/* A page of zeros, shared read-only by every PAGE_ZERO page that
+   has been read but never written, such as most of a large bss.
+   A write fault on one of them gives it a frame of its own. */
+static void *zero_page;
+
+/* Number of large pages held by all processes.  Their frames are
+   never evicted, so together they may take at most half of the
+   user pool, and the rest is left for ordinary pages. */
+static size_t large_page_cnt;
+static struct lock large_page_lock;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static void destroy_page (struct hash_elem *, void *aux);
+
+/* Initializes the page module. */
+void
+page_init (void)
+{
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  lock_init (&large_page_lock);
+}
+
+/* Initializes the current thread's supplemental page table.
+   Returns false if memory allocation fails. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the current thread's supplemental page table, freeing
+   the frames and swap slots of its pages.  Must be called before
+   the page directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  hash_destroy (&thread_current ()->pages, destroy_page);
+}
+
+/* Adds a page at UPAGE to the current thread's page table and
+   returns it, or returns NULL if UPAGE is already present or
+   memory allocation fails. */
+static struct page *
+add_page (void *upage, enum page_type type, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->pagedir = thread_current ()->pagedir;
+  p->type = type;
+  p->writable = writable;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->share = NULL;
+  p->file = NULL;
+  p->ofs = 0;
+  p->read_bytes = 0;
+  p->write_back = false;
+  p->dirty = false;
+  p->swap_slot = SWAP_ERROR;
+  p->large_kpage = NULL;
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Records that UPAGE is to be loaded from the READ_BYTES bytes
+   at offset OFS in FILE, followed by zeros up to the end of the
+   page.  FILE must stay open, and must not be written, as long as
+   the page exists.  A read-only page is shared with every other
+   process that maps the same bytes of the same file.
+   Returns true if successful, false otherwise. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  if (read_bytes == 0)
+    return page_add_zero (upage, writable);
+  p = add_page (upage, PAGE_FILE, writable);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  if (!writable)
+    {
+      p->share = share_get (p, file, ofs, read_bytes);
+      if (p->share == NULL)
+        {
+          hash_delete (&thread_current ()->pages, &p->hash_elem);
+          free (p);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Records that UPAGE maps the READ_BYTES bytes at offset OFS in
+   FILE.  Unlike page_add_file(), changes to the page are written
+   back to FILE when it is evicted or removed.
+   Returns true if successful, false otherwise. */
+bool
+page_add_mapped (void *upage, struct file *file, off_t ofs,
+                 size_t read_bytes)
+{
+  struct page *p;
+
+  ASSERT (read_bytes > 0 && read_bytes <= PGSIZE);
+
+  p = add_page (upage, PAGE_FILE, true);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->write_back = true;
+  return true;
+}
+
+/* Records that UPAGE is to be filled with zeros.
+   Returns true if successful, false otherwise. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  return add_page (upage, PAGE_ZERO, writable) != NULL;
+}
+
+/* Counts one more large page against the budget.  Returns false,
+   and counts nothing, if the budget is used up. */
+static bool
+large_page_reserve (void)
+{
+  bool success;
+
+  lock_acquire (&large_page_lock);
+  success = ((large_page_cnt + 1) * LARGE_PAGE_PAGES
+             <= palloc_user_page_cnt () / 2);
+  if (success)
+    large_page_cnt++;
+  lock_release (&large_page_lock);
+  return success;
+}
+
+/* Gives back a large page counted by large_page_reserve(). */
+static void
+large_page_release (void)
+{
+  lock_acquire (&large_page_lock);
+  ASSERT (large_page_cnt > 0);
+  large_page_cnt--;
+  lock_release (&large_page_lock);
+}
+
+/* Adds a copy of page Q of a process that is forking to the
+   current thread's page table.  EXE_FILE is the current thread's
+   own handle on the executable.  Q's contents, if they are in a
+   frame or in swap, become an anonymous shared page that both
+   processes refer to until one of them writes to it.  A page of
+   a mapped file is not copied; it is written back if it is dirty,
+   so that the current thread's own mapping of the file, made by
+   mmap_fork(), reads the same data.  Returns true if successful,
+   false if memory allocation fails. */
+static bool
+fork_page (struct page *q, struct file *exe_file)
+{
+  struct page *c = NULL;
+  bool success = false;
+
+  lock_acquire (&q->lock);
+  if (q->large_kpage != NULL)
+    {
+      /* The frames of a large page cannot be shared, since they
+         cannot be evicted one at a time, so copy them now.  The
+         copy counts against the budget like any large page. */
+      c = add_page (q->upage, PAGE_ZERO, q->writable);
+      if (c == NULL || !large_page_reserve ())
+        goto done;
+      c->large_kpage = palloc_get_aligned (PAL_USER, LARGE_PAGE_PAGES,
+                                           PTSPAN);
+      if (c->large_kpage == NULL)
+        {
+          large_page_release ();
+          goto done;
+        }
+      memcpy (c->large_kpage, q->large_kpage, PTSPAN);
+      pagedir_set_large_page (c->pagedir, c->upage, c->large_kpage,
+                              c->writable);
+      success = true;
+      goto done;
+    }
+  if (q->write_back)
+    {
+      if (q->frame != NULL && pagedir_is_dirty (q->pagedir, q->upage))
+        {
+          file_write_at (q->file, q->frame->kpage, q->read_bytes, q->ofs);
+          pagedir_set_dirty (q->pagedir, q->upage, false);
+        }
+      success = true;
+      goto done;
+    }
+
+  if (q->share == NULL && (q->frame != NULL || q->swap_slot != SWAP_ERROR)
+      && share_anon (q) == NULL)
+    goto done;
+  c = add_page (q->upage, q->type, q->writable);
+  if (c == NULL)
+    goto done;
+  if (q->share != NULL && q->share->inode == NULL)
+    share_add (q->share, c);
+  else if (q->type == PAGE_FILE)
+    {
+      c->file = exe_file;
+      c->ofs = q->ofs;
+      c->read_bytes = q->read_bytes;
+      if (q->share != NULL)
+        {
+          c->share = share_get (c, exe_file, q->ofs, q->read_bytes);
+          if (c->share == NULL)
+            goto done;
+        }
+    }
+  success = true;
+
+ done:
+  lock_release (&q->lock);
+  return success;
+}
+
+/* Copies the supplemental page table of PARENT, which must be
+   blocked in fork(), into the current thread's, which is PARENT's
+   new child.  This takes time in proportion to the number of
+   pages, not to their size, since no page is copied until it is
+   written.  Returns true if successful, false if memory
+   allocation fails. */
+bool
+page_table_fork (struct thread *parent, struct file *exe_file)
+{
+  struct hash_iterator i;
+
+  hash_first (&i, &parent->pages);
+  while (hash_next (&i))
+    if (!fork_page (hash_entry (hash_cur (&i), struct page, hash_elem),
+                    exe_file))
+      return false;
+  return true;
+}
+
+/* Removes the page at UPAGE from the current thread's page table
+   and frees it, writing it back to its file first if needed. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+  hash_delete (&thread_current ()->pages, &p->hash_elem);
+  destroy_page (&p->hash_elem, NULL);
+}
+
+/* Returns the page containing user address ADDR in the current
+   thread's page table, or a null pointer if there is none.  For
+   an address in a large page, that is the region's first page. */
+struct page *
+page_lookup (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  /* Kernel threads have no page table. */
+  if (t->pagedir == NULL)
+    return NULL;
+
+  p.upage = pg_round_down (addr);
+  e = hash_find (&t->pages, &p.hash_elem);
+  if (e == NULL && (uintptr_t) p.upage % PTSPAN != 0)
+    {
+      struct page *q;
+
+      p.upage = (void *) ((uintptr_t) addr & ~(uintptr_t) (PTSPAN - 1));
+      e = hash_find (&t->pages, &p.hash_elem);
+      q = e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+      return q != NULL && q->large_kpage != NULL ? q : NULL;
+    }
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns the page containing user address ADDR, like
+   page_lookup().  If there is none but ADDR looks like an access
+   to the stack, the stack grows down to ADDR with zeroed pages.
+   The current thread's user_esp must be up to date. */
+static struct page *
+find_page (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct page *p = page_lookup (addr);
+  uint8_t *upage = pg_round_down (addr);
+
+  if (p != NULL || t->pagedir == NULL)
+    return p;
+  if ((uint8_t *) addr < (uint8_t *) PHYS_BASE - STACK_MAX
+      || (uint8_t *) addr < (uint8_t *) t->user_esp - STACK_SLOP
+      || !is_user_vaddr (addr))
+    return NULL;
+  if (!page_add_zero (upage, true))
+    return NULL;
+  return page_lookup (upage);
+}
+
+/* Number of pages after the faulting one that swap_in() reads
+   from swap along with it. */
+#define SWAP_READ_AHEAD 7
+
+/* Maps page Q, which has just been read into frame F, and
+   releases the swap slot it came from.  The slot is released
+   right away, so the page has to be written out again if it is
+   evicted, dirty or not.  If Q cannot be mapped, frees F and
+   leaves Q in swap.  Returns true if successful, false
+   otherwise. */
+static bool
+swap_in_done (struct page *q, struct frame *f)
+{
+  if (!pagedir_set_page (q->pagedir, q->upage, f->kpage, q->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  swap_free (q->swap_slot);
+  q->swap_slot = SWAP_ERROR;
+  q->frame = f;
+  return true;
+}
+
+/* Reads page P, which is in swap, into frame F and maps it.
+   Pages of the same process in the slots right after P's were
+   most likely evicted along with it, so as many of them as can
+   be given a frame without evicting anything are read in the
+   same pass.  The requests for the run of slots are merged by
+   the swap device's queue into one transfer.  Returns true if P
+   was brought in, false otherwise. */
+static bool
+swap_in (struct page *p, struct frame *f)
+{
+  struct page *next[SWAP_READ_AHEAD];
+  struct frame *frames[SWAP_READ_AHEAD];
+  size_t cnt, i, n = 0;
+  bool success;
+
+  swap_submit (p->swap_slot, f->kpage, false, &f->io);
+
+  cnt = swap_neighbours (p, next, SWAP_READ_AHEAD);
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *q = next[i];
+      size_t slot = p->swap_slot + i + 1;
+      struct frame *g;
+
+      /* Q may be being evicted or freed by someone else. */
+      if (!lock_try_acquire (&q->lock))
+        break;
+      if (q->frame != NULL || q->swap_slot != slot)
+        {
+          lock_release (&q->lock);
+          break;
+        }
+      g = frame_try_alloc (q, NULL);
+      if (g == NULL)
+        {
+          lock_release (&q->lock);
+          break;
+        }
+      swap_submit (slot, g->kpage, false, &g->io);
+      next[n] = q;
+      frames[n++] = g;
+    }
+
+  block_wait (&f->io);
+  success = swap_in_done (p, f);
+  for (i = 0; i < n; i++)
+    {
+      block_wait (&frames[i]->io);
+      swap_in_done (next[i], frames[i]);
+      lock_release (&next[i]->lock);
+    }
+  return success;
+}
+
+/* Brings page P into a frame and maps it, unless it is already
+   there, as directed by FLAGS.  P's lock must be held.  Returns
+   true if successful, false if P is to be written but is
+   read-only, if no frame is available, or if reading the page
+   fails.
+
+   Without PAGE_IN_WRITE, a PAGE_ZERO page is mapped read-only to
+   the zero page instead of a frame.  There is nothing to pin or
+   evict then, and the zero page is never freed. */
+static bool
+page_in (struct page *p, enum page_in_flags flags)
+{
+  struct frame *f;
+  uint8_t *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  if ((flags & PAGE_IN_WRITE) && !p->writable)
+    return false;
+  if (p->large_kpage != NULL)
+    return true;
+  if (p->share != NULL)
+    {
+      /* Only an anonymous shared page can be writable. */
+      if (!(flags & PAGE_IN_WRITE))
+        return share_map (p->share, p, flags);
+      if (!share_copy (p->share, p))
+        return false;
+    }
+  if (p->frame != NULL)
+    goto done;
+  if (p->type == PAGE_ZERO)
+    {
+      bool zero_mapped = pagedir_get_page (p->pagedir, p->upage) != NULL;
+      if (!(flags & PAGE_IN_WRITE))
+        return (zero_mapped
+                || pagedir_set_page (p->pagedir, p->upage, zero_page,
+                                     false));
+      if (zero_mapped)
+        pagedir_clear_page (p->pagedir, p->upage);
+    }
+
+  f = (flags & PAGE_IN_NO_EVICT
+       ? frame_try_alloc (p, NULL)
+       : frame_alloc (p, NULL));
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  switch (p->type)
+    {
+    case PAGE_FILE:
+      if (file_read_at (p->file, kpage, p->read_bytes, p->ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+      break;
+
+    case PAGE_ZERO:
+      memset (kpage, 0, PGSIZE);
+      break;
+
+    case PAGE_SWAP:
+      if (!swap_in (p, f))
+        return false;
+      goto done;
+
+    default:
+      NOT_REACHED ();
+    }
+
+  if (!pagedir_set_page (p->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+
+ done:
+  if (flags & PAGE_IN_PIN)
+    p->frame->pin_cnt++;
+  return true;
+}
+
+/* Brings the page containing user address ADDR into memory and
+   maps it, growing the stack if ADDR is just below it.  If WRITE
+   is true, the page is made ready to be written.  Returns true if
+   the page is now present, false if ADDR is not part of the
+   address space or the page cannot be loaded or is read-only
+   when WRITE is true. */
+bool
+page_load (const void *addr, bool write)
+{
+  struct page *p = find_page (addr);
+  bool success;
+
+  if (p == NULL)
+    return false;
+  lock_acquire (&p->lock);
+  success = page_in (p, write ? PAGE_IN_WRITE : 0);
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Returns the page at UPAGE if it is a file page that is not
+   mapped yet and reads from the same file as page P. */
+static struct page *
+around_page (struct page *p, uint8_t *upage)
+{
+  struct page *q = page_lookup (upage);
+
+  if (q == NULL || q->type != PAGE_FILE || q->file != p->file
+      || pagedir_get_page (q->pagedir, upage) != NULL)
+    return NULL;
+  return q;
+}
+
+/* Returns true if page Q can be brought in without disk I/O. */
+static bool
+in_memory (struct page *q)
+{
+  return ((q->share != NULL && q->share->frame != NULL)
+          || inode_is_cached (file_get_inode (q->file), q->ofs,
+                              q->read_bytes));
+}
+
+/* Like page_load(), for a page fault, including a write fault
+   on a page that is mapped read-only.  A fault on a file page
+   also brings in the other file pages of the same file in the
+   aligned window of fault_around_pages pages around it: those
+   whose data is already in memory are mapped right away, without
+   evicting anything, and reads of the others are started in the
+   background.  The reads of the window go to the disk together,
+   so the block layer can merge them, and a sequential scan takes
+   one fault per window instead of one per page. */
+bool
+page_load_around (const void *addr, bool write)
+{
+  struct page *p = find_page (addr);
+  uint8_t *start;
+  size_t i;
+  bool success;
+
+  if (p == NULL)
+    return false;
+  if (fault_around_pages <= 1 || p->type != PAGE_FILE)
+    return page_load (addr, write);
+
+  start = ((uint8_t *) p->upage
+           - pg_no (p->upage) % fault_around_pages * PGSIZE);
+  for (i = 0; i < fault_around_pages; i++)
+    {
+      struct page *q = around_page (p, start + i * PGSIZE);
+      if (q != NULL && !in_memory (q))
+        inode_read_ahead (file_get_inode (q->file), q->ofs, q->read_bytes);
+    }
+
+  lock_acquire (&p->lock);
+  success = page_in (p, write ? PAGE_IN_WRITE : 0);
+  lock_release (&p->lock);
+  if (!success)
+    return false;
+
+  for (i = 0; i < fault_around_pages; i++)
+    {
+      struct page *q = around_page (p, start + i * PGSIZE);
+      bool mapped = true;
+
+      if (q == NULL || !in_memory (q))
+        continue;
+      lock_acquire (&q->lock);
+      if (q->type == PAGE_FILE)
+        mapped = page_in (q, PAGE_IN_NO_EVICT);
+      lock_release (&q->lock);
+      if (!mapped)
+        break;
+    }
+  return true;
+}
+
+/* Like page_load(), but also keeps the page from being evicted
+   until page_unpin() is called for it.  System calls pin user
+   buffers that the kernel accesses while holding locks that
+   bringing a page in would need. */
+bool
+page_pin (const void *addr, bool write)
+{
+  struct page *p = find_page (addr);
+  bool success;
+
+  if (p == NULL)
+    return false;
+  lock_acquire (&p->lock);
+  success = page_in (p, PAGE_IN_PIN | (write ? PAGE_IN_WRITE : 0));
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Backs the 4 MB region at UPAGE, which must be 4 MB aligned,
+   with a single large page, so that the whole region takes one
+   TLB entry instead of 1,024.  Every page of the region must be
+   a writable PAGE_ZERO page that has never been written, such as
+   the pages of a large array in the bss.  The region is given
+   physically contiguous frames up front, and they stay until the
+   process exits.  Since those frames are never evicted, all the
+   large pages of all processes together may take at most half of
+   the user pool.  Returns false, leaving the region to ordinary
+   pages, if the CPU lacks 4 MB pages, if the region does not
+   qualify, if that budget is used up, or if no aligned run of
+   free frames is left. */
+bool
+page_make_large (void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page *first;
+  size_t i;
+
+  if (!cpu_has_features (CPUID_EDX_PSE) || t->pagedir == NULL
+      || (uintptr_t) upage % PTSPAN != 0 || !is_user_vaddr (upage))
+    return false;
+
+  for (i = 0; i < LARGE_PAGE_PAGES; i++)
+    {
+      struct page *p = page_lookup ((uint8_t *) upage + i * PGSIZE);
+      if (p == NULL || p->upage != (uint8_t *) upage + i * PGSIZE
+          || p->type != PAGE_ZERO || !p->writable || p->frame != NULL
+          || p->share != NULL || p->large_kpage != NULL)
+        return false;
+    }
+
+  if (!large_page_reserve ())
+    return false;
+  first = page_lookup (upage);
+  first->large_kpage = palloc_get_aligned (PAL_USER | PAL_ZERO,
+                                           LARGE_PAGE_PAGES, PTSPAN);
+  if (first->large_kpage == NULL)
+    {
+      large_page_release ();
+      return false;
+    }
+
+  /* Drop the mappings of the zero page and all entries but the
+     first, which now stands for the whole region. */
+  for (i = 0; i < LARGE_PAGE_PAGES; i++)
+    {
+      struct page *p = page_lookup ((uint8_t *) upage + i * PGSIZE);
+      pagedir_clear_page (t->pagedir, p->upage);
+      if (p != first)
+        {
+          hash_delete (&t->pages, &p->hash_elem);
+          free (p);
+        }
+    }
+  pagedir_set_large_page (t->pagedir, upage, first->large_kpage, true);
+  return true;
+}
+
+/* Allows the page containing ADDR to be evicted again. */
+void
+page_unpin (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL);
+  lock_acquire (&p->lock);
+  if (p->share != NULL)
+    share_unpin (p->share);
+  else if (p->frame != NULL)
+    {
+      ASSERT (p->frame->pin_cnt > 0);
+      p->frame->pin_cnt--;
+    }
+  lock_release (&p->lock);
+}
+
+/* Returns true if page Q, whose lock the caller holds and which
+   is in a frame, has to go to swap if it is evicted. */
+bool
+page_needs_swap (struct page *q)
+{
+  ASSERT (lock_held_by_current_thread (&q->lock));
+  ASSERT (q->frame != NULL);
+
+  return (!q->write_back
+          && (q->type == PAGE_SWAP
+              || pagedir_is_dirty (q->pagedir, q->upage)));
+}
+
+/* Starts evicting page Q, whose lock the caller holds: unmaps it
+   and, if its contents cannot be brought back from its file,
+   reserves a swap slot for them.  Returns false, leaving Q
+   mapped, if swap is full. */
+bool
+page_unmap (struct page *q)
+{
+  enum intr_level old_level;
+  bool dirty;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+  ASSERT (q->frame != NULL);
+
+  /* The owner must not dirty the page between the check and the
+     unmapping. */
+  old_level = intr_disable ();
+  dirty = pagedir_is_dirty (q->pagedir, q->upage);
+  pagedir_clear_page (q->pagedir, q->upage);
+  intr_set_level (old_level);
+
+  if (q->write_back)
+    q->dirty = dirty;
+  else if (dirty || q->type == PAGE_SWAP)
+    {
+      q->swap_slot = swap_alloc (q);
+      if (q->swap_slot == SWAP_ERROR)
+        {
+          /* Nowhere to put it, so it has to stay. */
+          pagedir_set_page (q->pagedir, q->upage, q->frame->kpage,
+                            q->writable);
+          pagedir_set_dirty (q->pagedir, q->upage, dirty);
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Continues evicting page Q after page_unmap(): writes it back to
+   its file, or starts writing it to its swap slot.  Evicting
+   several pages by starting all their writes before finishing
+   any lets the writes to neighbouring slots go out together. */
+void
+page_write_begin (struct page *q)
+{
+  ASSERT (lock_held_by_current_thread (&q->lock));
+
+  if (q->write_back && q->dirty)
+    {
+      file_write_at (q->file, q->frame->kpage, q->read_bytes, q->ofs);
+      q->dirty = false;
+    }
+  else if (q->swap_slot != SWAP_ERROR)
+    swap_submit (q->swap_slot, q->frame->kpage, true, &q->frame->io);
+}
+
+/* Finishes evicting page Q after page_write_begin(): waits for
+   the write to swap, if any, and detaches Q from its frame. */
+void
+page_write_end (struct page *q)
+{
+  ASSERT (lock_held_by_current_thread (&q->lock));
+
+  if (q->swap_slot != SWAP_ERROR)
+    {
+      block_wait (&q->frame->io);
+      q->type = PAGE_SWAP;
+    }
+  q->frame = NULL;
+}
+
+/* Returns a hash value for page P_. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
+
+/* Frees page P_ along with its frame or swap slot, writing a
+   dirty mapped page back to its file.  A mapping of the zero page
+   is only cleared, so that pagedir_destroy() does not free it.
+   Waits for an eviction of the page that is in progress to
+   finish. */
+static void
+destroy_page (struct hash_elem *p_, void *aux UNUSED)
+{
+  struct page *p = hash_entry (p_, struct page, hash_elem);
+
+  lock_acquire (&p->lock);
+  if (p->large_kpage != NULL)
+    {
+      pagedir_clear_large_page (p->pagedir, p->upage);
+      palloc_free_multiple (p->large_kpage, LARGE_PAGE_PAGES);
+      large_page_release ();
+    }
+  else if (p->share != NULL)
+    share_put (p->share, p);
+  else if (p->frame != NULL)
+    {
+      if (p->write_back && pagedir_is_dirty (p->pagedir, p->upage))
+        file_write_at (p->file, p->frame->kpage, p->read_bytes, p->ofs);
+      pagedir_clear_page (p->pagedir, p->upage);
+      frame_free (p->frame);
+    }
+  else
+    pagedir_clear_page (p->pagedir, p->upage);
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+  free (p);
+}
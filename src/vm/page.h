@@ -0,0 +1,93 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct thread;
+
+/* Where the contents of a page come from when it is brought in. */
+enum page_type
+  {
+    PAGE_FILE,                  /* Read from a file, zero the rest. */
+    PAGE_ZERO,                  /* Zeros, shared until written. */
+    PAGE_SWAP                   /* Only in memory or in a swap slot. */
+  };
+
+/* Options for bringing a page in. */
+enum page_in_flags
+  {
+    PAGE_IN_PIN = 001,          /* Keep the frame from eviction. */
+    PAGE_IN_NO_EVICT = 002,     /* Fail instead of evicting a page. */
+    PAGE_IN_WRITE = 004         /* The page is about to be written. */
+  };
+
+/* Supplemental page table entry.  Describes one page of a
+   process's virtual address space, whether or not it is
+   currently in memory. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    uint32_t *pagedir;          /* Owner's page directory. */
+    struct hash_elem hash_elem; /* Element in thread's page table. */
+    enum page_type type;        /* Backing store. */
+    bool writable;              /* True if the user may write it. */
+
+    /* Held while the page is brought in, evicted, or freed. */
+    struct lock lock;
+    struct frame *frame;        /* Frame holding the page, or NULL. */
+
+    /* Read-only file pages are shared between processes, and so
+       are the private pages of a process that forked until they
+       are written.  FRAME and SWAP_SLOT are not used for them. */
+    struct share *share;        /* Shared page, or NULL. */
+    struct list_elem share_elem; /* Element in share's page list. */
+
+    /* PAGE_FILE only. */
+    struct file *file;          /* File to read from. */
+    off_t ofs;                  /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read, the rest is zeroed. */
+    bool write_back;            /* Write changes to FILE, not to swap. */
+    bool dirty;                 /* Set by page_unmap() to write back. */
+
+    /* PAGE_SWAP only. */
+    size_t swap_slot;           /* Slot holding the page, or SWAP_ERROR. */
+
+    /* A 4 MB region made into a large page by page_make_large()
+       has only this entry, for its first page.  Its frames are
+       never evicted. */
+    void *large_kpage;          /* The region's frames, or NULL. */
+  };
+
+/* Pages brought in by a fault on a file page. */
+extern size_t fault_around_pages;
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_table_fork (struct thread *parent, struct file *exe_file);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_mapped (void *upage, struct file *, off_t ofs,
+                      size_t read_bytes);
+bool page_add_zero (void *upage, bool writable);
+void page_remove (void *upage);
+struct page *page_lookup (const void *addr);
+bool page_load (const void *addr, bool write);
+bool page_load_around (const void *addr, bool write);
+bool page_pin (const void *addr, bool write);
+bool page_make_large (void *upage);
+void page_unpin (const void *addr);
+
+bool page_needs_swap (struct page *);
+bool page_unmap (struct page *);
+void page_write_begin (struct page *);
+void page_write_end (struct page *);
+
+#endif /* vm/page.h */
@@ -0,0 +1,399 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "filesys/page-cache.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* The sharing table maps (inode, offset) to the read-only file
+   pages that are shared between processes.  The executable is
+   kept from being written while it runs, so every process that
+   maps the same bytes of it sees the same contents.  Anonymous
+   shared pages are only reachable through the pages that refer
+   to them, so they are not in the table.  A share of a file holds
+   its own reference to the file's inode, so that the inode cannot
+   be freed, and its address reused by another inode, while the
+   share is in the table.
+
+   Lock order: a page's lock, then SHARES_LOCK, then a share's
+   lock, then the frame table's lock. */
+static struct hash shares;
+static struct lock shares_lock;
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the sharing table. */
+void
+share_init (void)
+{
+  if (!hash_init (&shares, share_hash, share_less, NULL))
+    PANIC ("share: hash table creation failed");
+  lock_init (&shares_lock);
+}
+
+/* Makes page P refer to the shared page that holds the
+   READ_BYTES bytes at offset OFS in FILE, followed by zeros,
+   creating it if no other page refers to it yet.  Returns the
+   shared page, or a null pointer if memory allocation fails. */
+struct share *
+share_get (struct page *p, struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct share key, *s;
+  struct hash_elem *e;
+
+  key.inode = file_get_inode (file);
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  lock_acquire (&shares_lock);
+  e = hash_find (&shares, &key.hash_elem);
+  if (e != NULL)
+    s = hash_entry (e, struct share, hash_elem);
+  else
+    {
+      s = malloc (sizeof *s);
+      if (s == NULL)
+        {
+          lock_release (&shares_lock);
+          return NULL;
+        }
+      s->inode = inode_reopen (key.inode);
+      s->ofs = ofs;
+      s->read_bytes = read_bytes;
+      lock_init (&s->lock);
+      s->frame = NULL;
+      s->cache_page = NULL;
+      list_init (&s->pages);
+      s->swap_slot = SWAP_ERROR;
+      hash_insert (&shares, &s->hash_elem);
+    }
+
+  lock_acquire (&s->lock);
+  list_push_back (&s->pages, &p->share_elem);
+  lock_release (&s->lock);
+  lock_release (&shares_lock);
+  return s;
+}
+
+/* Turns private page Q, whose lock the caller holds and which is
+   in a frame or in swap, into an anonymous shared page that only
+   Q refers to so far, and returns it.  Q is mapped read-only from
+   now on.  Returns a null pointer if memory allocation fails. */
+struct share *
+share_anon (struct page *q)
+{
+  struct share *s;
+
+  ASSERT (lock_held_by_current_thread (&q->lock));
+  ASSERT (q->share == NULL);
+  ASSERT (q->frame != NULL || q->swap_slot != SWAP_ERROR);
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    return NULL;
+  s->inode = NULL;
+  s->ofs = 0;
+  s->read_bytes = 0;
+  lock_init (&s->lock);
+  list_init (&s->pages);
+  list_push_back (&s->pages, &q->share_elem);
+  s->frame = q->frame;
+  s->cache_page = NULL;
+  s->swap_slot = q->swap_slot;
+
+  lock_acquire (&s->lock);
+  if (s->frame != NULL)
+    {
+      /* The page table already exists, so remapping cannot
+         fail. */
+      pagedir_clear_page (q->pagedir, q->upage);
+      pagedir_set_page (q->pagedir, q->upage, s->frame->kpage, false);
+      frame_set_owner (s->frame, NULL, s);
+    }
+  if (s->swap_slot != SWAP_ERROR)
+    swap_set_page (s->swap_slot, NULL);
+  lock_release (&s->lock);
+
+  q->share = s;
+  q->frame = NULL;
+  q->swap_slot = SWAP_ERROR;
+  q->type = PAGE_SWAP;
+  return s;
+}
+
+/* Makes page P refer to anonymous shared page S too.  P is mapped
+   when it is first accessed. */
+void
+share_add (struct share *s, struct page *p)
+{
+  ASSERT (s->inode == NULL);
+
+  lock_acquire (&s->lock);
+  list_push_back (&s->pages, &p->share_elem);
+  lock_release (&s->lock);
+  p->share = s;
+}
+
+/* Unmaps page P from shared page S and drops its reference.  S
+   and its frame or swap slot are freed when the last reference
+   goes away. */
+void
+share_put (struct share *s, struct page *p)
+{
+  bool last;
+
+  lock_acquire (&shares_lock);
+  lock_acquire (&s->lock);
+  pagedir_clear_page (p->pagedir, p->upage);
+  list_remove (&p->share_elem);
+  last = list_empty (&s->pages);
+  if (last)
+    {
+      if (s->inode != NULL)
+        hash_delete (&shares, &s->hash_elem);
+      if (s->frame != NULL)
+        frame_free (s->frame);
+      if (s->cache_page != NULL)
+        pcache_unmap (s->cache_page);
+      if (s->swap_slot != SWAP_ERROR)
+        swap_free (s->swap_slot);
+    }
+  lock_release (&s->lock);
+  lock_release (&shares_lock);
+
+  if (last)
+    {
+      inode_close (s->inode);
+      free (s);
+    }
+}
+
+/* Maps shared page S into page P, read-only, reading it in first
+   through P's file, or from swap if S is anonymous, unless
+   another process already has.  A whole page of a file is mapped
+   from the page cache if it has room for it.  With PAGE_IN_PIN,
+   the frame is kept from eviction until share_unpin().  Returns
+   true if successful, false otherwise. */
+bool
+share_map (struct share *s, struct page *p, enum page_in_flags flags)
+{
+  void *kpage;
+  bool success;
+
+  lock_acquire (&s->lock);
+  if (s->frame == NULL && s->cache_page == NULL && s->inode != NULL
+      && s->read_bytes == PGSIZE && s->ofs % PGSIZE == 0)
+    s->cache_page = inode_map_page (s->inode, s->ofs);
+  if (s->frame == NULL && s->cache_page == NULL)
+    {
+      struct frame *f = (flags & PAGE_IN_NO_EVICT
+                         ? frame_try_alloc (NULL, s)
+                         : frame_alloc (NULL, s));
+      if (f == NULL)
+        {
+          lock_release (&s->lock);
+          return false;
+        }
+      if (s->inode == NULL)
+        {
+          /* The slot is released right away, so the page has to
+             be written out again if it is evicted. */
+          swap_submit (s->swap_slot, f->kpage, false, &f->io);
+          block_wait (&f->io);
+          swap_free (s->swap_slot);
+          s->swap_slot = SWAP_ERROR;
+        }
+      else if (file_read_at (p->file, f->kpage, s->read_bytes, s->ofs)
+               != (off_t) s->read_bytes)
+        {
+          frame_free (f);
+          lock_release (&s->lock);
+          return false;
+        }
+      else
+        memset ((uint8_t *) f->kpage + s->read_bytes, 0,
+                PGSIZE - s->read_bytes);
+      s->frame = f;
+    }
+  kpage = s->cache_page != NULL ? s->cache_page->data : s->frame->kpage;
+  success = pagedir_set_page (p->pagedir, p->upage, kpage, false);
+  if (success && (flags & PAGE_IN_PIN) && s->frame != NULL)
+    s->frame->pin_cnt++;
+  lock_release (&s->lock);
+  return success;
+}
+
+/* Gives page P, whose lock the caller holds and which refers to
+   anonymous shared page S, a private copy of S that it may write,
+   and maps it read/write.  If P is the last page that refers to
+   S, P takes over S's frame or swap slot instead, and a page in
+   swap is left for the caller to bring in.  Either way, P becomes
+   a private PAGE_SWAP page.  Returns true if successful, false if
+   no frame is available. */
+bool
+share_copy (struct share *s, struct page *p)
+{
+  struct frame *f;
+  bool last;
+
+  ASSERT (s->inode == NULL);
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  lock_acquire (&s->lock);
+  last = list_begin (&s->pages) == list_rbegin (&s->pages);
+  if (last)
+    f = s->frame;
+  else
+    {
+      f = frame_alloc (p, NULL);
+      if (f == NULL)
+        goto fail;
+      if (s->frame != NULL)
+        memcpy (f->kpage, s->frame->kpage, PGSIZE);
+      else
+        {
+          swap_submit (s->swap_slot, f->kpage, false, &f->io);
+          block_wait (&f->io);
+        }
+    }
+
+  pagedir_clear_page (p->pagedir, p->upage);
+  if (f != NULL && !pagedir_set_page (p->pagedir, p->upage, f->kpage, true))
+    {
+      if (!last)
+        frame_free (f);
+      goto fail;
+    }
+  if (last)
+    {
+      if (f != NULL)
+        frame_set_owner (f, p, NULL);
+      p->swap_slot = s->swap_slot;
+      if (p->swap_slot != SWAP_ERROR)
+        swap_set_page (p->swap_slot, p);
+    }
+  list_remove (&p->share_elem);
+  lock_release (&s->lock);
+  if (last)
+    free (s);
+
+  p->share = NULL;
+  p->frame = f;
+  p->type = PAGE_SWAP;
+  return true;
+
+ fail:
+  lock_release (&s->lock);
+  return false;
+}
+
+/* Undoes one share_map() with PAGE_IN_PIN.  A page cache page is
+   never evicted, so it was not pinned. */
+void
+share_unpin (struct share *s)
+{
+  lock_acquire (&s->lock);
+  if (s->cache_page == NULL)
+    {
+      ASSERT (s->frame != NULL && s->frame->pin_cnt > 0);
+      s->frame->pin_cnt--;
+    }
+  lock_release (&s->lock);
+}
+
+/* Called by the frame table with its lock held to evict shared
+   page S.  Fails if S is busy or pinned, if any process has
+   accessed it since the last call, in which case the accessed
+   bits are cleared, or if S is anonymous and swap is full.
+   Otherwise unmaps S from every process, detaches it from its
+   frame, and returns with S's lock held for share_write_out(). */
+bool
+share_unmap (struct share *s)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  /* The current thread may be making a copy of S. */
+  if (lock_held_by_current_thread (&s->lock)
+      || !lock_try_acquire (&s->lock))
+    return false;
+  ASSERT (s->frame != NULL);
+  if (s->frame->pin_cnt > 0)
+    {
+      lock_release (&s->lock);
+      return false;
+    }
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    {
+      struct page *q = list_entry (e, struct page, share_elem);
+      if (pagedir_is_accessed (q->pagedir, q->upage))
+        {
+          pagedir_set_accessed (q->pagedir, q->upage, false);
+          accessed = true;
+        }
+    }
+  if (accessed
+      || (s->inode == NULL
+          && (s->swap_slot = swap_alloc (NULL)) == SWAP_ERROR))
+    {
+      lock_release (&s->lock);
+      return false;
+    }
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    {
+      struct page *q = list_entry (e, struct page, share_elem);
+      pagedir_clear_page (q->pagedir, q->upage);
+    }
+  s->frame = NULL;
+  return true;
+}
+
+/* Finishes evicting shared page S from frame F after
+   share_unmap(), without the frame table's lock: writes an
+   anonymous page to its swap slot, then releases S's lock.  A
+   file page is never dirty, so there is nothing to write back. */
+void
+share_write_out (struct share *s, struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&s->lock));
+
+  if (s->inode == NULL)
+    {
+      swap_submit (s->swap_slot, f->kpage, true, &f->io);
+      block_wait (&f->io);
+    }
+  lock_release (&s->lock);
+}
+
+/* Returns a hash value for shared page S_. */
+static unsigned
+share_hash (const struct hash_elem *s_, void *aux UNUSED)
+{
+  const struct share *s = hash_entry (s_, struct share, hash_elem);
+  return hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs);
+}
+
+/* Returns true if shared page A precedes shared page B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share *a = hash_entry (a_, struct share, hash_elem);
+  const struct share *b = hash_entry (b_, struct share, hash_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,56 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+#include "vm/page.h"
+
+struct file;
+struct inode;
+struct pcache_page;
+
+/* A page that several processes share.  Either a read-only page
+   of a file that every process mapping the same bytes of the same
+   file shares, such as a page of program text, or an anonymous
+   page that fork() left to a parent and its child, mapped
+   read-only in both until one of them writes to it.  It lives as
+   long as some process has a page that refers to it.
+
+   A whole page of a file is mapped straight from the file
+   system's page cache if it can be, instead of being copied into
+   a frame of its own.  It then stays in memory until the last
+   process unmaps it. */
+struct share
+  {
+    struct hash_elem hash_elem; /* Element in the sharing table. */
+    struct inode *inode;        /* Reopened inode, or NULL if anonymous. */
+    off_t ofs;                  /* Offset in the file. */
+    size_t read_bytes;          /* Bytes read, the rest is zeroed. */
+
+    /* Held while the frame is brought in or evicted. */
+    struct lock lock;
+    struct frame *frame;        /* Frame holding the page, or NULL. */
+    struct pcache_page *cache_page; /* Page cache page, or NULL. */
+    struct list pages;          /* Pages that refer to this one. */
+
+    /* Anonymous only. */
+    size_t swap_slot;           /* Slot holding the page, or SWAP_ERROR. */
+  };
+
+void share_init (void);
+struct share *share_get (struct page *, struct file *, off_t ofs,
+                         size_t read_bytes);
+struct share *share_anon (struct page *);
+void share_add (struct share *, struct page *);
+void share_put (struct share *, struct page *);
+bool share_map (struct share *, struct page *, enum page_in_flags);
+bool share_copy (struct share *, struct page *);
+void share_unpin (struct share *);
+bool share_unmap (struct share *);
+void share_write_out (struct share *, struct frame *);
+
+#endif /* vm/share.h */
@@ -0,0 +1,126 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* The swap device is divided into page-sized slots.  Slots are
+   handed out in increasing order from where the last one was
+   found, so the pages that one eviction writes out end up next
+   to each other on disk and go out as one request, and a process
+   that is swapped out in one go can be read back the same way. */
+
+/* Sectors per slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;       /* Swap device, or NULL. */
+static struct bitmap *used_slots;       /* In-use slots. */
+static struct page **slot_pages;        /* Page in each used slot. */
+static size_t next_slot;                /* Where to look for a slot. */
+static struct lock swap_lock;           /* Protects the above. */
+
+/* Initializes the swap slot allocator.  Without a swap device,
+   every allocation fails, so only pages that can be reloaded
+   from their files are ever evicted. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  else
+    printf ("swap: no swap device, swapping disabled\n");
+
+  used_slots = bitmap_create (slot_cnt);
+  slot_pages = calloc (slot_cnt + 1, sizeof *slot_pages);
+  if (used_slots == NULL || slot_pages == NULL)
+    PANIC ("swap: slot table creation failed");
+  next_slot = 0;
+  lock_init (&swap_lock);
+}
+
+/* Allocates a swap slot for page P, or for a shared page if P is
+   null, and returns it, or returns SWAP_ERROR if the swap device
+   is full. */
+size_t
+swap_alloc (struct page *p)
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (used_slots, next_slot, 1, false);
+  if (slot == BITMAP_ERROR && next_slot != 0)
+    slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  if (slot != BITMAP_ERROR)
+    {
+      slot_pages[slot] = p;
+      next_slot = slot + 1;
+    }
+  lock_release (&swap_lock);
+  return slot;
+}
+
+/* Frees SLOT. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+  slot_pages[slot] = NULL;
+  lock_release (&swap_lock);
+}
+
+/* Records that SLOT now holds page P, or a shared page if P is
+   null. */
+void
+swap_set_page (size_t slot, struct page *p)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  slot_pages[slot] = p;
+  lock_release (&swap_lock);
+}
+
+/* Stores in PAGES up to MAX pages of the same process as page P,
+   which must be in swap, that occupy the slots right after P's,
+   and returns how many there are.  Pages are only ever freed by
+   the process they belong to, so the caller, which must be that
+   process, may use them after the swap lock is released. */
+size_t
+swap_neighbours (struct page *p, struct page **pages, size_t max)
+{
+  size_t cnt = 0;
+
+  ASSERT (p->swap_slot != SWAP_ERROR);
+
+  lock_acquire (&swap_lock);
+  while (cnt < max && p->swap_slot + cnt + 1 < bitmap_size (used_slots))
+    {
+      struct page *q = slot_pages[p->swap_slot + cnt + 1];
+      if (q == NULL || q->pagedir != p->pagedir)
+        break;
+      pages[cnt++] = q;
+    }
+  lock_release (&swap_lock);
+  return cnt;
+}
+
+/* Starts transferring the page at KPAGE to SLOT if WRITE is true,
+   or SLOT to KPAGE otherwise, using REQ.  Wait for it with
+   block_wait().  Requests for neighbouring slots are merged by
+   the swap device's queue. */
+void
+swap_submit (size_t slot, void *kpage, bool write, struct block_request *req)
+{
+  ASSERT (bitmap_test (used_slots, slot));
+  block_request_init (req, write, slot * SECTORS_PER_SLOT,
+                      SECTORS_PER_SLOT, kpage, NULL, NULL);
+  block_submit (swap_device, req);
+}
@@ -0,0 +1,22 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <bitmap.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct block_request;
+struct page;
+
+/* Returned by swap_alloc() when no slot is free. */
+#define SWAP_ERROR BITMAP_ERROR
+
+void swap_init (void);
+size_t swap_alloc (struct page *);
+void swap_free (size_t slot);
+void swap_set_page (size_t slot, struct page *);
+size_t swap_neighbours (struct page *, struct page **, size_t max);
+void swap_submit (size_t slot, void *kpage, bool write,
+                  struct block_request *);
+
+#endif /* vm/swap.h */